@@ -0,0 +1,103 @@
+/**
+ * @file AsyncWriter.h
+ * @brief Background thread for writing the FT1 and FT2 output files.
+ *
+ * $Header$
+ */
+
+#ifndef observationSim_AsyncWriter_h
+#define observationSim_AsyncWriter_h
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+namespace observationSim {
+
+/**
+ * @class AsyncWriter
+ *
+ * @brief Run the file writes of the Event and ScData containers in a
+ * single background thread, so that they overlap with the generation
+ * of the next buffer.
+ *
+ * The containers hand over their full buffers and keep filling empty
+ * ones.  At most maxPending writes are queued or running; submit()
+ * blocks until there is room, which bounds the memory held by the
+ * buffers being written.  The writes are done one at a time, in the
+ * order submitted.  Since tip and cfitsio are not thread-safe, each
+ * write holds fitsMutex() while it runs, and the code that reads FITS
+ * files in the calling thread during the simulation must hold it as
+ * well.  If a write throws, the later writes are discarded and the
+ * writer stays failed: every later submit() or wait() rethrows the
+ * exception in the calling thread, and no more writes are queued.
+ */
+
+class AsyncWriter {
+
+public:
+
+   typedef std::function<void()> Task;
+
+   /// @param maxPending The maximum number of writes queued or running.
+   AsyncWriter(size_t maxPending=2);
+
+   /// Finish the pending writes.  Any exception they throw is lost,
+   /// so wait() should be called first.
+   ~AsyncWriter();
+
+   /// Queue a write.  If an earlier write has failed, its exception
+   /// is rethrown instead.
+   void submit(const Task & task);
+
+   /// Block until the pending writes are finished, rethrowing the
+   /// exception from any of them.
+   void wait();
+
+   size_t maxPending() const {
+      return m_maxPending;
+   }
+
+   /// The mutex serializing the use of tip.  It is recursive, so
+   /// that the readers may lock it in nested calls, but it must not
+   /// be held while calling submit() or wait().
+   static std::recursive_mutex & fitsMutex();
+
+private:
+
+   size_t m_maxPending;
+
+   std::deque<Task> m_tasks;
+
+   /// True while a task is running.
+   bool m_busy;
+
+   /// Set by the destructor to stop the thread.
+   bool m_done;
+
+   std::exception_ptr m_error;
+
+   std::mutex m_mutex;
+   std::condition_variable m_taskReady;
+   std::condition_variable m_taskDone;
+
+   std::thread m_thread;
+
+   void run();
+
+   /// Rethrow the exception of the failed write, if any.  It is
+   /// kept, so that the writer stays failed.
+   void rethrowError() const;
+
+   AsyncWriter(const AsyncWriter &);
+   AsyncWriter & operator=(const AsyncWriter &);
+
+};
+
+} // namespace observationSim
+
+#endif // observationSim_AsyncWriter_h
@@ -9,7 +9,11 @@
 #ifndef observationSim_ContainerBase_h
 #define observationSim_ContainerBase_h
 
+#include <cstddef>
+#include <functional>
+#include <mutex>
 #include <string>
+#include <vector>
 
 #include "astro/JulianDate.h"
 
@@ -24,6 +28,10 @@ namespace tip {
 
 namespace observationSim {
 
+class AsyncWriter;
+class FitsHandle;
+class MemoryBudget;
+
 /**
  * @class ContainerBase
  *
@@ -39,9 +47,10 @@ public:
                  const st_app::AppParGroup * pars) 
       : m_filename(filename), m_tablename(tablename),
         m_maxNumEntries(maxNumEntries), m_pars(pars), m_fileNum(0),
-        m_appName(""), m_softwareVersion("") {}
+        m_appName(""), m_softwareVersion(""), m_budget(0), m_writer(0),
+        m_chunkRows(0), m_compress(false) {}
 
-   virtual ~ContainerBase() {}
+   virtual ~ContainerBase();
 
    virtual void setVersion(const std::string & version) {
       m_softwareVersion = version;
@@ -55,6 +64,41 @@ public:
       return m_appName + " " + m_softwareVersion;
    }
 
+   /// Include the buffered rows of this container in the given
+   /// budget, which must outlive the container.
+   void setMemoryBudget(MemoryBudget * budget);
+
+   /// Write the output files in the given writer's thread.  The
+   /// writer must outlive the container.
+   void setWriter(AsyncWriter * writer) {
+      m_writer = writer;
+   }
+
+   /// Write the rows to the current output file in chunks of the
+   /// given size as they are accepted, rather than buffering the
+   /// whole file.  The file is completed when it reaches the maximum
+   /// number of rows or the container is deleted.  If zero (the
+   /// default), each file is written at once.
+   void setChunkRows(unsigned int chunkRows) {
+      m_chunkRows = chunkRows;
+   }
+
+   /// Gzip each output file once it is complete, as part of the
+   /// file write, and append ".gz" to its name.  The compression
+   /// ratio and throughput are reported for each file.
+   void setCompression(bool compress) {
+      m_compress = compress;
+   }
+
+   /// The size of the buffered rows (bytes).
+   virtual size_t bufferedBytes() const = 0;
+
+   /// True if the buffered rows can be written to a file now.
+   virtual bool canFlush() const = 0;
+
+   /// Write the buffered rows to a file and clear the buffer.
+   virtual void flush() = 0;
+
 protected:
 
    /// Root name for the FITS binary table output files.
@@ -82,10 +126,51 @@ protected:
    /// The version of the application.
    std::string m_softwareVersion;
 
+   /// The memory budget shared with other containers, if any.
+   MemoryBudget * m_budget;
+
+   /// The background writer, if any.
+   AsyncWriter * m_writer;
+
+   /// Rows per chunk in streaming mode, or zero.
+   unsigned int m_chunkRows;
+
+   /// True if the output files are to be gzipped.
+   bool m_compress;
+
+   /// Run a file write in the writer thread if there is one, or
+   /// else now.  The task must not use the buffer being filled.
+   /// @param nbytes The size of the buffer that the task writes,
+   ///        which is counted in the memory budget until the task has
+   ///        finished or been discarded.
+   void submitWrite(const std::function<void()> & task, size_t nbytes=0);
+
+   /// Wait for the writes submitted by any container to finish.  This
+   /// must be called by the destructors of the derived classes, since
+   /// the writes use their data members.
+   void waitForWrites();
+
+   /// Have the memory budget check the buffer sizes after a row has
+   /// been added.
+   void checkMemoryBudget();
+
+   /// Write the memory budget and the peak buffered and resident
+   /// sizes so far.
+   void writeMemoryKeywords(tip::Header & header) const;
+
    /// Return an output filename, based on the root name, m_filename,
    /// and the counter index, m_fileNum.
    std::string outputFileName() const;
 
+   /// The name of an output file once it is complete, i.e., with
+   /// the ".gz" suffix if it is to be compressed.
+   std::string finalFileName(const std::string & fileName) const;
+
+   /// Gzip a complete output file, replacing it by finalFileName(),
+   /// if compression is enabled.  This is called at the end of the
+   /// file write, so it runs in the writer thread if there is one.
+   void compressFile(const std::string & fileName) const;
+
    void writeParFileParams(tip::Header & header) const;
 
    /// Set the date keywords in a given header, accesses via the
@@ -93,11 +178,31 @@ protected:
    static void writeDateKeywords(tip::Extension * table, double start_time,
                                  double stop_time, bool extension=true);
 
+   /// Set the date keywords, and TSTART and TSTOP, in the primary
+   /// header of a file, through its open handle.
+   static void writePhduDateKeywords(FitsHandle & fits,
+                                     double start_time, double stop_time);
+
    /// Return an astro::JulianDate object for the current time.
    static astro::JulianDate currentTime();
 
 private:
 
+   struct CompressionReport {
+      std::string fileName;
+      size_t inputBytes;
+      size_t outputBytes;
+      double seconds;
+   };
+
+   /// The files compressed since the last report.  These are written
+   /// by the writer thread and reported by the calling thread, since
+   /// the st_stream output is not thread-safe.
+   mutable std::vector<CompressionReport> m_compressed;
+   mutable std::mutex m_compressedMutex;
+
+   void reportCompression();
+
    void write_par_as_string(tip::Header & header,
                             const std::string & keyword,
                             const std::string & parname) const;
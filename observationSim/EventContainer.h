@@ -8,8 +8,10 @@
 #ifndef observationSim_EventContainer_h
 #define observationSim_EventContainer_h
 
+#include <cmath>
 #include <fstream>
 #include <map>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -35,6 +37,9 @@ namespace dataSubselector {
 
 namespace observationSim {
 
+class EventGeometry;
+class FitsHandle;
+
 /**
  * @class EventContainer
  * @brief Stores and writes Events to a FITS file.
@@ -56,8 +61,16 @@ public:
                   bool applyEdisp=true,
                   const st_app::AppParGroup * pars=0);
 
+   /// Complete the current file if close() has not been called.
+   /// Exceptions are not propagated, so close() should be called
+   /// first.
    ~EventContainer();
 
+   /// Write the buffered events, complete the current FT1 file and
+   /// wait for the writes to finish, rethrowing any exception they
+   /// throw.
+   void close();
+
    /// @param event A pointer to the current EventSource object
    ///        that was provided by the FluxMgr object.
    /// @param respPtrs A vector of pointers to response 
@@ -68,31 +81,147 @@ public:
    ///        for accessing spacecraft orbit and attitude information.
    /// @param flush A flag to indicate whether to write the accumulated
    ///        Event data and then flush the buffers.
+   /// @param live True if the caller has already found that the
+   ///        spacecraft is outside of the SAA at the event time, so
+   ///        that the orbit model need not be evaluated again.
    bool addEvent(EventSource * event, 
                  std::vector<irfInterface::Irfs *> & respPtrs, 
-                 Spacecraft * spacecraft, bool flush=false);
+                 Spacecraft * spacecraft, bool flush=false,
+                 bool live=false);
+
+   /// Add an event that has already passed the livetime and
+   /// effective area tests, e.g., one drawn from the exposure by an
+   /// EventFeed.  The PSF, energy dispersion and cuts are applied as
+   /// for addEvent(...).
+   /// @param time Arrival time (MET s).
+   /// @param energy True energy (MeV).
+   /// @param launchDir Photon direction in the instrument frame.
+   /// @param sourceDir True photon direction.
+   /// @param respPtr The response functions that detected the photon.
+   /// @param spacecraft Provides the spacecraft attitude.
+   /// @param srcName Name of the source.
+   /// @param eventId ID number of the source.
+   /// @param applyEdisp Whether the source allows energy dispersion.
+   bool addDetectedEvent(double time, double energy,
+                         const CLHEP::Hep3Vector & launchDir,
+                         const astro::SkyDir & sourceDir,
+                         irfInterface::Irfs * respPtr,
+                         Spacecraft * spacecraft,
+                         const std::string & srcName, int eventId,
+                         bool applyEdisp=true);
+
+   /// Add an event that was generated in a previous run and read
+   /// from a cache.  Only the deadtime test is applied.
+   bool addCachedEvent(const Event & event, const std::string & srcName,
+                       int eventId);
+
+   /// Add an event read from an existing event list.  Since it was
+   /// recorded, it is always accepted.
+   void addMergedEvent(const Event & event, const std::string & srcName,
+                       int eventId);
+
+   /// Add to the number of incident photons for the named source.
+   void addIncidentPhotons(const std::string & srcName, int eventId,
+                           unsigned long nphot);
 
    /// The number of events in the container.
-   long numEvents() {return m_events.size();}
+   long numEvents() {return m_buffer.size();}
 
    /// The acceptance probability for any event is typically the ratio
    /// of the livetime to elapsed time for a given observation
    /// interval.
    void setAcceptanceProb(double prob) {m_prob = prob;}
 
-   /// Return a const reference to m_events for processing by Python
-   /// of the data contained therein.
-   const std::vector<Event> & getEvents() const {return m_events;}
+   /// Restrict the simulation to photons with true directions within
+   /// radius of center.  Photons from outside this region are
+   /// discarded before the livetime and response function tests and
+   /// are not counted as incident.  The radius should include a
+   /// conservative bound on the PSF containment so that the accepted
+   /// events within the acceptance cone are unaffected.
+   /// @param center Center of the region of interest.
+   /// @param radius Radius of the region (degrees).
+   void setRoi(const astro::SkyDir & center, double radius) {
+      m_roiCenter = center;
+      m_roiRadius = radius*M_PI/180.;
+      m_useRoi = (radius < 180.);
+   }
+
+   /// A conservative padding (degrees) of the region of interest for
+   /// the PSF: the radius containing all but a fraction
+   /// s_psfLeakage of the widest PSF over the response functions and
+   /// over inclinations up to 70 degrees, evaluated at energy (MeV).
+   /// If that radius exceeds maxMargin, 180 is returned, so that
+   /// neither the source pruning nor the early rejection discards
+   /// anything.
+   static double psfMargin(const std::vector<irfInterface::Irfs *> &
+                           respPtrs, double energy, double maxMargin=30.);
+
+   /// The largest fraction of the photons from a source outside the
+   /// padded region that could have produced an event within it.
+   static const double s_psfLeakage;
+
+   /// The number of photons discarded because they lie outside the
+   /// region set by setRoi(...).
+   unsigned long roiRejected() const {
+      return m_roiRejected;
+   }
+
+   /// The values of an FT1 column for the buffered events, for
+   /// processing by Python of the data contained therein.  In
+   /// streaming mode, these are only the events not yet written.
+   /// Only the columns TIME, ENERGY, RA, DEC, L, B, THETA, PHI,
+   /// ZENITH_ANGLE and EARTH_AZIMUTH_ANGLE are available, since the
+   /// true directions and instrument axes are not kept; a
+   /// std::invalid_argument is thrown for any other name.
+   void getColumn(const std::string & name, std::vector<double> & values);
+
+   /// The buffered events, for processing by Python of the data
+   /// contained therein.  The events are built on demand from the
+   /// FT1 columns, so the true direction is the apparent one, and
+   /// the instrument axes and zenith are only determined up to a
+   /// rotation about it: theta(), phi() and zenAngle() give the
+   /// FT1 values, but the axes themselves are not those of the
+   /// spacecraft.
+   std::vector<Event> getEvents();
+
+   /// The most recently accepted event, with all of its attributes.
+   const Event & lastEvent() const {return m_lastEvent;}
 
    /// struct to contain event summary for a given source
    class SourceSummary {
    public:
       SourceSummary(int idnum=0) : id(idnum), incidentNum(0), acceptedNum(0) {}
       int id;
+      /// Number of incident photons, counting only those within the
+      /// region of interest if one has been set.
       unsigned long incidentNum;
       unsigned long acceptedNum;
    };
 
+   /// Add an entry to the event summaries for the named source, so
+   /// that it is listed even if it provides no events.
+   void addSourceSummary(const std::string & name, int eventId) {
+      setEventId(name, eventId);
+   }
+
+   virtual size_t bufferedBytes() const {
+      return m_buffer.size()*EventBuffer::rowBytes();
+   }
+
+   virtual bool canFlush() const {
+      return m_buffer.size() > 0;
+   }
+
+   /// In streaming mode, write the buffered events to the current
+   /// file; otherwise complete the file.
+   virtual void flush() {
+      if (m_chunkRows > 0) {
+         appendRows();
+      } else {
+         writeEvents();
+      }
+   }
+
    /// Access to the map of event IDs.
    const std::map<std::string, SourceSummary> & eventIds() const {
       return m_srcSummaries;
@@ -107,13 +236,77 @@ private:
 
    dataSubselector::Cuts * m_cuts;
 
+   /// A copy of the cuts, made once and shared by the output files,
+   /// for use by the write tasks.
+   std::shared_ptr<const dataSubselector::Cuts> m_outputCuts;
+
    double m_startTime;
    double m_stopTime;
 
    bool m_applyEdisp;
 
-   /// The Event buffer.
-   std::vector<Event> m_events;
+   /// Region of interest for the true photon directions.
+   bool m_useRoi;
+   astro::SkyDir m_roiCenter;
+   double m_roiRadius;
+   unsigned long m_roiRejected;
+
+   /// The event buffer, with one array for each FT1 column.  The
+   /// columns written as single precision are stored as such.
+   struct EventBuffer {
+      std::vector<double> time;
+      std::vector<float> energy;
+      std::vector<float> ra;
+      std::vector<float> dec;
+      std::vector<float> l;
+      std::vector<float> b;
+      std::vector<float> theta;
+      std::vector<float> phi;
+      std::vector<float> zenithAngle;
+      std::vector<float> earthAzimuth;
+      std::vector<unsigned int> eventClass;
+      std::vector<unsigned int> eventType;
+      std::vector<short> convType;
+      std::vector<int> eventId;
+      std::vector<float> trueEnergy;
+      size_t size() const {return time.size();}
+      static size_t rowBytes() {
+         return sizeof(double) + 10*sizeof(float) + 2*sizeof(unsigned int)
+            + sizeof(short) + sizeof(int);
+      }
+      void reserve(size_t n);
+      void clear();
+      void swap(EventBuffer & other);
+   };
+   EventBuffer m_buffer;
+
+   /// The FT1 file being written.  Once created, this is only used
+   /// by the write tasks, which may run in the writer thread.
+   struct Ft1Output {
+      std::string fileName;
+      std::string creatorName;
+      std::shared_ptr<const dataSubselector::Cuts> cuts;
+      bool bitEventClass;
+      tip::Table * table;
+      /// A cfitsio handle on the same file for the column writes.
+      std::unique_ptr<FitsHandle> fits;
+      long nrows;
+      Ft1Output();
+      ~Ft1Output();
+      /// The table, or a std::runtime_error if the file could not be
+      /// created or is already closed, so that the writes after a
+      /// failed one do nothing.
+      tip::Table * openTable() const;
+   };
+   std::shared_ptr<Ft1Output> m_output;
+
+   /// The number of rows of the current file handed to the writer.
+   size_t m_outputRows;
+
+   /// The events whose direction columns have not yet been computed.
+   EventGeometry * m_geometry;
+
+   Event m_lastEvent;
    
    int m_eventClass;
    int m_eventType;
@@ -124,18 +317,61 @@ private:
    /// This routine contains the constructor implementation.
    void init();
 
+   /// Apply the PSF, energy dispersion and cuts to a photon that has
+   /// passed the acceptance tests, and store the resulting event.
+   /// Return true if the event was stored.
+   bool storeEvent(double time, double energy,
+                   const astro::SkyDir & sourceDir,
+                   const astro::SkyDir & zAxis,
+                   const astro::SkyDir & xAxis,
+                   double flux_theta, double flux_phi,
+                   irfInterface::Irfs * respPtr, bool source_apply_edisp,
+                   const std::string & srcName);
+
+   /// Apply the deadtime test, if requested, and add the event to the
+   /// buffer, first writing the buffer if it is full.  The added event
+   /// is then available as lastEvent().
+   bool appendEvent(const Event & event, const std::string & srcName,
+                    bool applyDeadtime=true);
+
+   /// Fill the output columns for the event.
+   void bufferEvent(const Event & event);
+
+   /// Compute the direction columns of the events in m_geometry.
+   void fillGeometry();
+
    /// Set the event ID for the named source, if it does not already exist.
    void setEventId(const std::string & name, int eventId);
 
    /// Return the zenith for the current spacecraft location.
    astro::SkyDir ScZenith(double time) const;
 
-   /// Return the Earth azimuth angle of the apparent event direction.
-   double earthAzimuthAngle(double ra, double dec, double time) const;
+   /// The number of rows in the current file, including those
+   /// still buffered.
+   size_t fileRows() const {
+      return m_outputRows + m_buffer.size();
+   }
 
-   /// A routine to unpack and write the Event buffer to an FT1 file.
+   /// Write the buffered events and complete the current FT1 file.
    void writeEvents(double obsStopTime=-1.);
 
+   /// Append the buffered events to the current FT1 file, creating
+   /// it if necessary.
+   void appendRows();
+
+   /// The write tasks.  These may run in the writer thread, so they
+   /// only use their arguments and the data members that are fixed
+   /// during the simulation.
+   void createFile(const std::shared_ptr<Ft1Output> & output) const;
+
+   void writeRows(const std::shared_ptr<Ft1Output> & output,
+                  const std::shared_ptr<EventBuffer> & buffer) const;
+
+   /// Set the row count dependent keywords, write the GTI extension
+   /// and the checksums.
+   void closeFile(const std::shared_ptr<Ft1Output> & output,
+                  double start_time, double stop_time) const;
+
 };
 
 } // namespace observationSim
@@ -0,0 +1,49 @@
+/**
+ * @file EventFeed.h
+ * @brief Interface for sources of events that are generated outside
+ * of the photon-by-photon simulation.
+ *
+ * $Header$
+ */
+
+#ifndef observationSim_EventFeed_h
+#define observationSim_EventFeed_h
+
+namespace observationSim {
+
+class EventContainer;
+
+/**
+ * @class EventFeed
+ *
+ * @brief Abstract interface for sources of events that do not come
+ * from the FluxMgr photon sources, e.g., events sampled directly from
+ * the exposure.  Simulator merges the events from each feed, in time
+ * order, with those from the photon sources.
+ */
+
+class EventFeed {
+
+public:
+
+   virtual ~EventFeed() {}
+
+   /// If the next event from this feed arrives before tmax, set time
+   /// to its arrival time and return true.
+   virtual bool nextTime(double tmax, double & time) = 0;
+
+   /// Add the event found by nextTime(...) to the container.  Return
+   /// true if it was accepted.
+   virtual bool addEvent(EventContainer & events) = 0;
+
+   /// Record in the container any bookkeeping, such as the number of
+   /// incident photons, that has not yet been passed to it.
+   virtual void flush(EventContainer & events) {
+      (void)(events);
+   }
+
+};
+
+} // namespace observationSim
+
+#endif // observationSim_EventFeed_h
@@ -0,0 +1,99 @@
+/**
+ * @file MemoryBudget.h
+ * @brief Bound on the memory used by the output buffers of the
+ * Event and ScData containers.
+ *
+ * $Header$
+ */
+
+#ifndef observationSim_MemoryBudget_h
+#define observationSim_MemoryBudget_h
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <vector>
+
+namespace observationSim {
+
+class ContainerBase;
+
+/**
+ * @class MemoryBudget
+ *
+ * @brief Keep the total size of the buffered rows of a set of
+ * containers within a fixed number of bytes.
+ *
+ * The containers call check() whenever a row is added.  If the total
+ * exceeds the budget, the container with the largest buffer writes
+ * its rows to a file, so that an output file is rolled over before
+ * maxrows is reached.  The buffers handed to an AsyncWriter are
+ * counted until their writes have finished, and if they alone exceed
+ * the budget, check() waits for them.  The peak total size and the
+ * peak resident set size of the process are recorded for the output
+ * headers.
+ */
+
+class MemoryBudget {
+
+public:
+
+   /// @param maxBytes The budget in bytes.  If zero, the buffers are
+   ///        only limited by the maximum number of rows, but the peak
+   ///        sizes are still recorded.
+   MemoryBudget(size_t maxBytes=0)
+      : m_maxBytes(maxBytes), m_peakBytes(0), m_writingBytes(0) {}
+
+   /// Include the container in the budget.  This is normally done
+   /// via ContainerBase::setMemoryBudget(...).
+   void addContainer(ContainerBase * container);
+
+   void removeContainer(ContainerBase * container);
+
+   /// Update the peak size and write out the largest buffers, or
+   /// wait for the writes in progress, until the total is within the
+   /// budget.
+   void check();
+
+   /// Count the size of a buffer handed to the writer, until
+   /// releaseWriting(...) is called for it.  This is normally done
+   /// via ContainerBase::submitWrite(...).
+   void addWriting(size_t nbytes);
+
+   /// Called, possibly by the writer thread, when the write using
+   /// the buffer has finished or been discarded.
+   void releaseWriting(size_t nbytes);
+
+   size_t maxBytes() const {
+      return m_maxBytes;
+   }
+
+   /// The largest total size of the buffered rows, including those
+   /// being written, so far (bytes).
+   size_t peakBytes() const {
+      return m_peakBytes;
+   }
+
+   /// The peak resident set size of the process (bytes), or zero if
+   /// it is not available on this platform.
+   static size_t peakRss();
+
+private:
+
+   size_t m_maxBytes;
+   /// Atomic since the output headers may be written by an
+   /// AsyncWriter thread.
+   std::atomic<size_t> m_peakBytes;
+   std::vector<ContainerBase *> m_containers;
+
+   /// The size of the buffers being written.
+   size_t m_writingBytes;
+   std::mutex m_writingMutex;
+   std::condition_variable m_writingReleased;
+
+};
+
+} // namespace observationSim
+
+#endif // observationSim_MemoryBudget_h
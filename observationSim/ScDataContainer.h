@@ -9,19 +9,25 @@
 #define observationSim_ScDataContainer_h
 
 #include <fstream>
+#include <memory>
 #include <string>
 #include <vector>
 
 #include "astro/SkyDir.h"
 
 #include "observationSim/ContainerBase.h"
-#include "observationSim/ScData.h"
 #include "observationSim/Spacecraft.h"
 
 class EventSource;
 
+namespace tip {
+   class Table;
+}
+
 namespace observationSim {
 
+class FitsHandle;
+
 /**
  * @class ScDataContainer
  * @brief Stores and writes ScData to a FITS file.
@@ -40,12 +46,21 @@ public:
                    int maxNumEntries=20000, bool writeData=true,
                    const st_app::AppParGroup * pars=0) : 
       ContainerBase(filename, tablename, maxNumEntries, pars),
-      m_writeData(writeData) {
+      m_writeData(writeData), m_simTime(0), m_outputRows(0),
+      m_prevTime(0) {
       init();
    }
 
+   /// Complete the current file if close() has not been called.
+   /// Exceptions are not propagated, so close() should be called
+   /// first.
    ~ScDataContainer();
 
+   /// Write the buffered rows, complete the current FT2 file and
+   /// wait for the writes to finish, rethrowing any exception they
+   /// throw.
+   void close();
+
    /// @param event A pointer to the current EventSource object
    ///        that was provided by the FluxMgr object.
    /// @param spacecraft A pointer to the object that provides methods
@@ -57,25 +72,126 @@ public:
 
    void addScData(double time, Spacecraft *spacecraft, bool flush=false);
 
-   /// The simulation time of the most recently added entry.
+   /// Add entries for a uniform grid of times, tstart + i*interval,
+   /// that are less than tstop.
+   void addScData(double tstart, double tstop, double interval,
+                  Spacecraft *spacecraft);
+
+   virtual size_t bufferedBytes() const {
+      return m_scData.size()*ScBuffer::rowBytes();
+   }
+
+   /// At least two rows are needed to give the stop time of the last.
+   virtual bool canFlush() const {
+      return m_scData.size() > 1;
+   }
+
+   /// In streaming mode, write all but the last buffered row to the
+   /// current file; otherwise complete the file.
+   virtual void flush() {
+      if (m_chunkRows > 0) {
+         appendRows(false);
+      } else {
+         writeScData();
+      }
+   }
+
+   /// The simulation time of the most recently added entry.  This
+   /// is kept even if the buffer has just been written.
    double simTime() {
-      return m_scData[m_scData.size()-1].time();
+      return m_simTime;
    }
 
 private:
 
-   /// The ScData buffer.
-   std::vector<ScData> m_scData;
+   /// The ScData buffer, with one array for each quantity.
+   struct ScBuffer {
+      std::vector<double> time;
+      std::vector<double> raScz;
+      std::vector<double> decScz;
+      std::vector<double> raScx;
+      std::vector<double> decScx;
+      std::vector<double> lon;
+      std::vector<double> lat;
+      std::vector<double> position;
+      std::vector<double> raZenith;
+      std::vector<double> decZenith;
+      std::vector<double> livetimeFrac;
+      std::vector<char> inSaa;
+      /// Filled when the buffer is handed to the writer.
+      std::vector<double> stop;
+      std::vector<double> geomagLat;
+      size_t size() const {return time.size();}
+      static size_t rowBytes() {
+         return 13*sizeof(double) + sizeof(char);
+      }
+      void reserve(size_t n);
+      void clear();
+      void swap(ScBuffer & other);
+      /// Append row i of other, without the stop and geomagLat values.
+      void appendRow(const ScBuffer & other, size_t i);
+      void resize(size_t n);
+   };
+   ScBuffer m_scData;
 
    /// Flag if ScData is to be written out to FT2 files.
    bool m_writeData;
 
+   double m_simTime;
+
+   /// The FT2 file being written.  Once created, this is only used
+   /// by the write tasks, which may run in the writer thread.
+   struct Ft2Output {
+      std::string fileName;
+      std::string creatorName;
+      double startTime;
+      tip::Table * table;
+      /// A cfitsio handle on the same file for the column writes.
+      std::unique_ptr<FitsHandle> fits;
+      long nrows;
+      Ft2Output();
+      ~Ft2Output();
+      /// The table, or a std::runtime_error if the file could not be
+      /// created or is already closed.
+      tip::Table * openTable() const;
+   };
+   std::shared_ptr<Ft2Output> m_output;
+
+   /// The number of rows of the current file handed to the writer.
+   size_t m_outputRows;
+
+   /// The time of the last row handed to the writer.
+   double m_prevTime;
+
    /// This routine contains the constructor implementation.
    void init();
 
-   /// This routine unpacks and writes the ScData to a FT2 file.
+   /// The number of rows in the current file, including those
+   /// still buffered.
+   size_t fileRows() const {
+      return m_outputRows + m_scData.size();
+   }
+
+   /// Write the buffered rows and complete the current FT2 file.
    void writeScData();
 
+   /// Append the buffered rows to the current FT2 file, creating it
+   /// if necessary.  Unless this is the end of the file, the last row
+   /// is kept, since its STOP is the START of the next one.  Return
+   /// the STOP of the last row written.
+   double appendRows(bool endOfFile);
+
+   /// The write tasks.  These may run in the writer thread, so they
+   /// only use their arguments and the data members that are fixed
+   /// during the simulation.
+   void createFile(const std::shared_ptr<Ft2Output> & output) const;
+
+   void writeRows(const std::shared_ptr<Ft2Output> & output,
+                  const std::shared_ptr<ScBuffer> & buffer) const;
+
+   void closeFile(const std::shared_ptr<Ft2Output> & output,
+                  double stop_time) const;
+
 };
 
 } // namespace observationSim
@@ -9,7 +9,9 @@
 #define observationSim_Simulator_h
 
 #include <iostream>
+#include <map>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include "CLHEP/Geometry/Vector3D.h"
@@ -27,12 +29,13 @@ namespace irfInterface {
 
 #include "observationSim/Spacecraft.h"
 
-class CompositeSource;
-
 namespace observationSim {
 
+class EventCacheWriter;
 class EventContainer;
+class EventFeed;
 class ScDataContainer;
+class SourceScheduler;
 
 /**
  * @class Simulator
@@ -87,6 +90,19 @@ public:
            maxSimTime, pointingHistoryOffset);
    }
 
+   /// Create a Simulator that only provides spacecraft data.  No
+   /// photon sources are created.
+   /// @param fileList A vector of xml file names using the source.dtd.
+   ///        These are only needed for creating the FluxMgr object.
+   /// @param startTime Absolute starting time of the simulation in seconds.
+   Simulator(const std::vector<std::string> & fileList,
+             double startTime=0.,
+             double maxSimTime=3.155e8)
+      : m_formatter(new st_stream::StreamFormatter("Simulator", "", 2)),
+        m_fluxMgr(0), m_source(0), m_newEvent(0) {
+      initFluxMgr(fileList, startTime, "", maxSimTime, 0);
+   }
+
    ~Simulator();
 
    /// Set the pointing history file.
@@ -133,8 +149,72 @@ public:
       makeEvents(events, scData, respPtrs, spacecraft, false);
    }
 
-   void setIdOffset(int id) {
-      m_fluxMgr->setIdOffset(id);
+   /// Generate spacecraft data only, on a uniform time grid, for a
+   /// given elapsed simulation time.  The photon event loop is
+   /// bypassed entirely.
+   void generateScData(double simulationTime, 
+                       ScDataContainer &scData,
+                       Spacecraft *spacecraft);
+
+   /// Set the time between successive ScData entries (s).  These are
+   /// generated on a uniform grid, independently of the photon
+   /// sources.
+   void setScDataInterval(double interval);
+
+   double scDataInterval() const {
+      return m_scInterval;
+   }
+
+   void setIdOffset(int id);
+
+   /// Remove point sources that lie farther than radius from center.
+   /// This is meant to be used with an acceptance cone cut, so radius
+   /// should include a conservative bound on the PSF containment.
+   /// Sources that do not have a fixed direction are retained.  This
+   /// must be called before any events are generated.
+   /// @param center Center of the acceptance cone.
+   /// @param radius Pruning radius (degrees).
+   void pruneSources(const astro::SkyDir & center, double radius);
+
+   /// Names and ID numbers of the sources removed by pruneSources(...).
+   const std::vector<std::pair<std::string, int> > & prunedSources() const {
+      return m_prunedSources;
+   }
+
+   /// Simulate the named sources by drawing their detected events
+   /// directly from the exposure, rather than photon by photon.  The
+   /// sources must be steady point sources.  This is applied at the
+   /// start of the first call to generateEvents(...), and only if
+   /// response functions are given.
+   void setExposureSources(const std::vector<std::string> & srcNames) {
+      m_exposureSrcNames = srcNames;
+   }
+
+   /// Keep the accepted events of each source in a file in cacheDir
+   /// named by the source's key.  A source whose file already exists
+   /// is replayed from it instead of being simulated.  The other
+   /// sources are simulated with their own random number engines,
+   /// seeded from their keys, and their files are written once the
+   /// simulation time has been covered.  The keys should therefore
+   /// depend on everything that affects a source's events.  The
+   /// events of a source are taken to be independent of the other
+   /// sources in the model: the livetime comes from the pointing
+   /// history or the livetime fraction, not from a simulated
+   /// deadtime.  Sources without keys are simulated as usual.  This
+   /// is applied at the start of the first call to
+   /// generateEvents(...), and only for a given simulation time.
+   /// @param cacheDir Existing directory for the cache files.
+   /// @param keys Hexadecimal keys, keyed by source name.
+   void setEventCache(const std::string & cacheDir,
+                      const std::map<std::string, std::string> & keys) {
+      m_eventCacheDir = cacheDir;
+      m_eventCacheKeys = keys;
+   }
+
+   /// Add a feed of events to be merged in time order with those from
+   /// the photon sources.  The Simulator takes ownership.
+   void addEventFeed(EventFeed * feed) {
+      m_feeds.push_back(feed);
    }
 
 protected:
@@ -147,7 +227,10 @@ private:
    st_stream::StreamFormatter * m_formatter;
 
    FluxMgr * m_fluxMgr;
-   CompositeSource * m_source;
+
+   /// The source library files read by m_fluxMgr.
+   std::vector<std::string> m_xmlFiles;
+   SourceScheduler * m_source;
    EventSource * m_newEvent;
 
    static std::vector<astro::GPS::RockType> s_rockTypes;
@@ -166,6 +249,28 @@ private:
 
    bool m_usePointingHistory;
 
+   std::vector<std::pair<std::string, int> > m_prunedSources;
+
+   std::vector<std::string> m_exposureSrcNames;
+
+   std::vector<EventFeed *> m_feeds;
+
+   std::string m_eventCacheDir;
+   std::map<std::string, std::string> m_eventCacheKeys;
+
+   /// Cache writers for the simulated sources, indexed as in
+   /// m_source.  Entries for sources without caches are null.
+   std::vector<EventCacheWriter *> m_cacheWriters;
+
+   /// Time between ScData entries and the time of the next entry.
+   double m_scInterval;
+   double m_nextScTime;
+
+   /// Create the FluxMgr and set up the spacecraft attitude.
+   void initFluxMgr(const std::vector<std::string> & fileList,
+                    double startTime, std::string pointingHistory,
+                    double maxSimTime, double pointingHistoryOffset);
+
    void init(const std::string & sourceName, 
              const std::vector<std::string> & fileList,
              double totalArea, double startTime, 
@@ -183,6 +288,36 @@ private:
 
    bool done();
 
+   /// Replace the sources named in m_exposureSrcNames by
+   /// ExposureSampler event feeds.
+   void createExposureSamplers(std::vector<irfInterface::Irfs *> & respPtrs,
+                               Spacecraft * spacecraft);
+
+   /// Replace the sources with cached events by feeds of those events,
+   /// and set up the caches for the others.
+   void openEventCaches();
+
+   /// Write the caches of the simulated sources.  If complete is
+   /// false, the simulation did not cover the requested time, so the
+   /// caches are discarded.
+   void closeEventCaches(EventContainer & events, bool complete);
+
+   /// The cache writer for the source of the current event, if any.
+   EventCacheWriter * cacheWriter() const;
+
+   /// Add the events from the feeds that arrive before time.
+   void drainFeeds(double time, EventContainer & events);
+
+   /// Advance the simulation clock by dt, without going past the end
+   /// of the current observation window.
+   void advanceClock(double dt, ScDataContainer & scData,
+                     Spacecraft * spacecraft);
+
+   /// Add the ScData entries on the time grid that precede time, if
+   /// spacecraft data are being generated.
+   void fillScData(double time, ScDataContainer & scData,
+                   Spacecraft * spacecraft);
+
 };
 
 } // namespace observationSim
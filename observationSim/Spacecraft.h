@@ -67,6 +67,21 @@ public:
       m_livetimeFrac = livetimeFrac;
    }
 
+   /// The earliest time, not before the given time, at which an
+   /// event could be accepted.  If time lies within a dead interval
+   /// (zero livetime or SAA passage), this returns a later time, at
+   /// or just past the end of that interval.  The default
+   /// implementation has no knowledge of dead intervals.
+   virtual double nextLiveTime(double time) {
+      return time;
+   }
+
+   /// True if nextLiveTime(time) returns time only when inSaa(time)
+   /// is false, so that callers need not evaluate inSaa(time) again.
+   virtual bool tracksDeadIntervals() const {
+      return false;
+   }
+
 private:
 
    double m_livetimeFrac;
@@ -11,6 +11,8 @@ def generate(env, **kw):
     env.Tool('irfsLib')
     env.Tool('dataSubselectorLib')
     env.Tool('fitsGenLib')
+    if env['PLATFORM'] != 'win32':
+        env.AppendUnique(LIBS = ['pthread', 'z'])
 
 def exists(env):
     return 1
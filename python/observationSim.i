@@ -7,7 +7,6 @@
 #include "observationSim/Event.h"
 #include "observationSim/EventContainer.h"
 #include "observationSim/FitsTable.h"
-#include "observationSim/ScData.h"
 #include "observationSim/ScDataContainer.h"
 #include "observationSim/Simulator.h"
 #include "observationSim/Roi.h"
@@ -22,7 +21,6 @@
 %include ../observationSim/Event.h
 %include ../observationSim/EventContainer.h
 %include ../observationSim/FitsTable.h
-%include ../observationSim/ScData.h
 %include ../observationSim/ScDataContainer.h
 %include ../observationSim/Simulator.h
 %include ../observationSim/Roi.h
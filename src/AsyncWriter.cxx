@@ -0,0 +1,95 @@
+/**
+ * @file AsyncWriter.cxx
+ * @brief Implementation of the background writer thread.
+ *
+ * $Header$
+ */
+
+#include <stdexcept>
+
+#include "observationSim/AsyncWriter.h"
+
+namespace observationSim {
+
+AsyncWriter::AsyncWriter(size_t maxPending)
+   : m_maxPending(maxPending), m_busy(false), m_done(false) {
+   if (m_maxPending == 0) {
+      throw std::invalid_argument("AsyncWriter: maxPending must be "
+                                  "positive.");
+   }
+   m_thread = std::thread(&AsyncWriter::run, this);
+}
+
+AsyncWriter::~AsyncWriter() {
+   {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_taskDone.wait(lock, [this]() {return m_tasks.empty() && !m_busy;});
+      m_done = true;
+   }
+   m_taskReady.notify_one();
+   m_thread.join();
+}
+
+void AsyncWriter::submit(const Task & task) {
+   {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_taskDone.wait(lock, [this]() {
+            return m_error || m_tasks.size() + m_busy < m_maxPending;
+         });
+      rethrowError();
+      m_tasks.push_back(task);
+   }
+   m_taskReady.notify_one();
+}
+
+void AsyncWriter::wait() {
+   std::unique_lock<std::mutex> lock(m_mutex);
+   m_taskDone.wait(lock, [this]() {return m_tasks.empty() && !m_busy;});
+   rethrowError();
+}
+
+std::recursive_mutex & AsyncWriter::fitsMutex() {
+   static std::recursive_mutex mutex;
+   return mutex;
+}
+
+void AsyncWriter::run() {
+   std::unique_lock<std::mutex> lock(m_mutex);
+   while (true) {
+      m_taskReady.wait(lock, [this]() {return m_done || !m_tasks.empty();});
+      if (m_tasks.empty()) {
+         return;
+      }
+      Task task(m_tasks.front());
+      m_tasks.pop_front();
+      m_busy = true;
+      lock.unlock();
+      std::exception_ptr error;
+      try {
+         std::lock_guard<std::recursive_mutex> fitsLock(fitsMutex());
+         task();
+      } catch (...) {
+         error = std::current_exception();
+      }
+// The task may hold resources, such as a share of the memory budget,
+// that must be released before wait() returns.
+      task = Task();
+      lock.lock();
+      m_busy = false;
+      if (error) {
+         if (!m_error) {
+            m_error = error;
+         }
+         m_tasks.clear();
+      }
+      m_taskDone.notify_all();
+   }
+}
+
+void AsyncWriter::rethrowError() const {
+   if (m_error) {
+      std::rethrow_exception(m_error);
+   }
+}
+
+} // namespace observationSim
@@ -0,0 +1,195 @@
+/**
+ * @file ColumnWriter.h
+ * @brief Write whole columns, keywords and checksums of the output
+ * FITS files, and read blocks of input columns, with cfitsio.
+ *
+ * $Header$
+ */
+
+#ifndef observationSim_ColumnWriter_h
+#define observationSim_ColumnWriter_h
+
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "fitsio.h"
+
+namespace observationSim {
+
+/**
+ * @brief The cfitsio datatype code for each column value type.  char
+ * is used only for logical columns, such as IN_SAA.
+ */
+template <typename T> struct FitsDataType;
+template <> struct FitsDataType<double> {enum {code = TDOUBLE};};
+template <> struct FitsDataType<float> {enum {code = TFLOAT};};
+template <> struct FitsDataType<int> {enum {code = TINT};};
+template <> struct FitsDataType<short> {enum {code = TSHORT};};
+template <> struct FitsDataType<unsigned char> {enum {code = TBYTE};};
+template <> struct FitsDataType<char> {enum {code = TLOGICAL};};
+
+/// Throw a std::runtime_error for a non-zero cfitsio status.
+inline void checkFitsStatus(int status, const std::string & message) {
+   if (status != 0) {
+      char text[FLEN_STATUS];
+      fits_get_errstatus(status, text);
+      throw std::runtime_error(message + ": " + text);
+   }
+}
+
+/**
+ * @brief A cfitsio handle for a binary table, closed when destroyed.
+ *
+ * If the file is already open, e.g., through tip, cfitsio shares
+ * the open file between the handles, so that the rows written
+ * through this one are seen by the other.
+ */
+class FitsHandle {
+
+public:
+
+   /// @param iomode READWRITE or READONLY.
+   FitsHandle(const std::string & fileName, const std::string & extName,
+              int iomode=READWRITE) : m_fptr(0) {
+      int status(0);
+      fits_open_file(&m_fptr, fileName.c_str(), iomode, &status);
+      checkFitsStatus(status, "Cannot open " + fileName);
+      fits_movnam_hdu(m_fptr, BINARY_TBL,
+                      const_cast<char *>(extName.c_str()), 0, &status);
+      if (status != 0) {
+         int closeStatus(0);
+         fits_close_file(m_fptr, &closeStatus);
+         checkFitsStatus(status, "Cannot find " + extName + " in "
+                         + fileName);
+      }
+   }
+
+   ~FitsHandle() {
+      if (m_fptr) {
+         int status(0);
+         fits_close_file(m_fptr, &status);
+      }
+   }
+
+   fitsfile * fptr() const {return m_fptr;}
+
+   /// Close the file, throwing a std::runtime_error on failure.
+   void close() {
+      int status(0);
+      fits_close_file(m_fptr, &status);
+      m_fptr = 0;
+      checkFitsStatus(status, "Cannot close FITS file");
+   }
+
+private:
+
+   fitsfile * m_fptr;
+
+   FitsHandle(const FitsHandle &);
+   FitsHandle & operator=(const FitsHandle &);
+
+};
+
+/// The number of the named column, throwing a std::runtime_error if
+/// there is none.
+inline int columnNumber(fitsfile * fptr, const std::string & field) {
+   int status(0);
+   int colnum(0);
+   fits_get_colnum(fptr, CASEINSEN, const_cast<char *>(field.c_str()),
+                   &colnum, &status);
+   checkFitsStatus(status, "Cannot find the " + field + " column");
+   return colnum;
+}
+
+/// Read nrows values of a scalar column, starting at the given
+/// (zero-based) row, with a single cfitsio call.
+inline void readColumn(fitsfile * fptr, int colnum, long firstRow,
+                       long nrows, std::vector<double> & values) {
+   values.resize(nrows);
+   if (nrows <= 0) {
+      return;
+   }
+   int status(0);
+   int anynul(0);
+   fits_read_col(fptr, TDOUBLE, colnum, firstRow + 1, 1, nrows, 0,
+                 &values[0], &anynul, &status);
+   checkFitsStatus(status, "Cannot read FITS column");
+}
+
+/// Set a string keyword in the current HDU, adding it if needed.
+inline void updateKey(fitsfile * fptr, const std::string & keyword,
+                      const std::string & value) {
+   int status(0);
+   fits_update_key(fptr, TSTRING, const_cast<char *>(keyword.c_str()),
+                   const_cast<char *>(value.c_str()), 0, &status);
+   checkFitsStatus(status, "Cannot write the " + keyword + " keyword");
+}
+
+/// Set a floating point keyword in the current HDU, adding it if
+/// needed.
+inline void updateKey(fitsfile * fptr, const std::string & keyword,
+                      double value) {
+   int status(0);
+   fits_update_key(fptr, TDOUBLE, const_cast<char *>(keyword.c_str()),
+                   &value, 0, &status);
+   checkFitsStatus(status, "Cannot write the " + keyword + " keyword");
+}
+
+/// Write the CHECKSUM and DATASUM keywords of every HDU, as the last
+/// change to the file.
+inline void writeChecksums(fitsfile * fptr) {
+   int status(0);
+   int nhdus(0);
+   fits_get_num_hdus(fptr, &nhdus, &status);
+   for (int hdu = 1; hdu <= nhdus && status == 0; hdu++) {
+      fits_movabs_hdu(fptr, hdu, 0, &status);
+      fits_write_chksum(fptr, &status);
+   }
+   checkFitsStatus(status, "Cannot write the checksums");
+}
+
+/**
+ * @brief Write the values to the named column, starting at the given
+ * (zero-based) row, with a single cfitsio call.
+ *
+ * The values of a vector column are given row by row, so that
+ * values.size() is the number of rows times the column width.  The
+ * table is extended as needed.
+ */
+template <typename T>
+void writeColumn(fitsfile * fptr, const std::string & field,
+                 const std::vector<T> & values, long firstRow=0) {
+   if (values.empty()) {
+      return;
+   }
+   int status(0);
+   int colnum(0);
+   fits_get_colnum(fptr, CASEINSEN, const_cast<char *>(field.c_str()),
+                   &colnum, &status);
+   fits_write_col(fptr, FitsDataType<T>::code, colnum, firstRow + 1, 1,
+                  values.size(), const_cast<T *>(&values[0]), &status);
+   checkFitsStatus(status, "Cannot write the " + field + " column");
+}
+
+/**
+ * @brief Write 32-bit masks to a 32X column, starting at the given
+ * row.  Bit 0 of each mask is the last bit of the cell.
+ */
+inline void writeBitColumn(fitsfile * fptr, const std::string & field,
+                           const std::vector<unsigned int> & masks,
+                           long firstRow=0) {
+// cfitsio writes an X column given as bytes four to the cell.
+   std::vector<unsigned char> bytes(4*masks.size());
+   for (size_t i = 0; i < masks.size(); i++) {
+      bytes[4*i] = (masks[i] >> 24) & 0xff;
+      bytes[4*i + 1] = (masks[i] >> 16) & 0xff;
+      bytes[4*i + 2] = (masks[i] >> 8) & 0xff;
+      bytes[4*i + 3] = masks[i] & 0xff;
+   }
+   writeColumn(fptr, field, bytes, firstRow);
+}
+
+} // namespace observationSim
+
+#endif // observationSim_ColumnWriter_h
@@ -5,20 +5,269 @@
  * $Header: /nfs/slac/g/glast/ground/cvs/ScienceTools-scons/observationSim/src/ContainerBase.cxx,v 1.8 2012/06/15 00:18:10 jchiang Exp $
  */
 
+#include <cmath>
+#include <cstdio>
 #include <ctime>
 
+#include <chrono>
+#include <fstream>
+#include <memory>
 #include <sstream>
 #include <stdexcept>
 
+#include <zlib.h>
+
 #include "st_app/AppParGroup.h"
 
+#include "st_stream/StreamFormatter.h"
+
 #include "tip/Extension.h"
 #include "tip/Header.h"
 
+#include "observationSim/AsyncWriter.h"
 #include "observationSim/ContainerBase.h"
+#include "observationSim/MemoryBudget.h"
+#include "ColumnWriter.h"
+#include "TempFileName.h"
+
+namespace {
+   const size_t gzipChunkSize(1024*1024);
+
+/// The calendar date of a mission elapsed time.
+   std::string missionDate(double time) {
+      static double secsPerDay(8.64e4);
+      astro::JulianDate mission_start(2006, 12, 31, 23.99888);
+      astro::JulianDate date(mission_start + time/secsPerDay);
+      return date.getGregorianDate();
+   }
+
+/// Counts a buffer being written in the memory budget for as long as
+/// the write task holding it exists.
+   class WritingBytes {
+   public:
+      WritingBytes(observationSim::MemoryBudget & budget, size_t nbytes)
+         : m_budget(budget), m_nbytes(nbytes) {
+         m_budget.addWriting(m_nbytes);
+      }
+      ~WritingBytes() {
+         m_budget.releaseWriting(m_nbytes);
+      }
+   private:
+      observationSim::MemoryBudget & m_budget;
+      size_t m_nbytes;
+      WritingBytes(const WritingBytes &);
+      WritingBytes & operator=(const WritingBytes &);
+   };
+
+/// Compress a stream in the gzip format, a chunk at a time.  The
+/// numbers of bytes read and written are returned in the arguments.
+   void deflateStream(std::istream & input, std::ostream & output,
+                      const std::string & inFile,
+                      const std::string & outFile,
+                      size_t & inputBytes, size_t & outputBytes) {
+      z_stream stream;
+      stream.zalloc = Z_NULL;
+      stream.zfree = Z_NULL;
+      stream.opaque = Z_NULL;
+// Adding 16 to the window size bits selects the gzip format.
+      if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16,
+                       8, Z_DEFAULT_STRATEGY) != Z_OK) {
+         throw std::runtime_error("ContainerBase::compressFile: "
+                                  "cannot initialize zlib.");
+      }
+      std::vector<char> inBuffer(gzipChunkSize);
+      std::vector<char> outBuffer(gzipChunkSize);
+      inputBytes = 0;
+      outputBytes = 0;
+      int flush(Z_NO_FLUSH);
+      while (flush != Z_FINISH) {
+         input.read(&inBuffer[0], inBuffer.size());
+         if (input.bad()) {
+            deflateEnd(&stream);
+            throw std::runtime_error("ContainerBase::compressFile: "
+                                     "error reading " + inFile);
+         }
+         stream.next_in = reinterpret_cast<Bytef *>(&inBuffer[0]);
+         stream.avail_in = input.gcount();
+         inputBytes += input.gcount();
+         flush = input.eof() ? Z_FINISH : Z_NO_FLUSH;
+         do {
+            stream.next_out = reinterpret_cast<Bytef *>(&outBuffer[0]);
+            stream.avail_out = outBuffer.size();
+            if (deflate(&stream, flush) == Z_STREAM_ERROR) {
+               deflateEnd(&stream);
+               throw std::runtime_error("ContainerBase::compressFile: "
+                                        "zlib error compressing " + inFile);
+            }
+            size_t nbytes(outBuffer.size() - stream.avail_out);
+            output.write(&outBuffer[0], nbytes);
+            outputBytes += nbytes;
+         } while (stream.avail_out == 0);
+         if (!output) {
+            deflateEnd(&stream);
+            throw std::runtime_error("ContainerBase::compressFile: "
+                                     "error writing " + outFile);
+         }
+      }
+      deflateEnd(&stream);
+   }
+
+/// Write a gzip copy of a file.  The copy is written to a temporary
+/// file of this process and renamed, so that an incomplete copy never
+/// has the final name.  The sizes of the input and output files are
+/// returned in the arguments.
+   void gzipFile(const std::string & inFile, const std::string & outFile,
+                 size_t & inputBytes, size_t & outputBytes) {
+      std::ifstream input(inFile.c_str(), std::ios::binary);
+      if (!input) {
+         throw std::runtime_error("ContainerBase::compressFile: "
+                                  "cannot open " + inFile);
+      }
+      std::string tmpFile(observationSim::tempFileName(outFile));
+      std::ofstream output(tmpFile.c_str(),
+                           std::ios::binary | std::ios::trunc);
+      if (!output) {
+         throw std::runtime_error("ContainerBase::compressFile: "
+                                  "cannot open " + tmpFile);
+      }
+      try {
+         deflateStream(input, output, inFile, outFile, inputBytes,
+                       outputBytes);
+         output.close();
+         if (!output) {
+            throw std::runtime_error("ContainerBase::compressFile: "
+                                     "error writing " + outFile);
+         }
+         if (std::rename(tmpFile.c_str(), outFile.c_str()) != 0) {
+            throw std::runtime_error("ContainerBase::compressFile: "
+                                     "cannot rename " + tmpFile
+                                     + " to " + outFile);
+         }
+      } catch (...) {
+         output.close();
+         std::remove(tmpFile.c_str());
+         throw;
+      }
+   }
+
+   double roundTo(double x, double unit) {
+      return std::floor(x/unit + 0.5)*unit;
+   }
+}
 
 namespace observationSim {
 
+ContainerBase::~ContainerBase() {
+   if (m_budget) {
+      m_budget->removeContainer(this);
+   }
+}
+
+void ContainerBase::setMemoryBudget(MemoryBudget * budget) {
+   if (m_budget) {
+      m_budget->removeContainer(this);
+   }
+   m_budget = budget;
+   if (m_budget) {
+      m_budget->addContainer(this);
+   }
+}
+
+void ContainerBase::checkMemoryBudget() {
+   if (m_budget) {
+      m_budget->check();
+   }
+}
+
+void ContainerBase::submitWrite(const std::function<void()> & task,
+                                size_t nbytes) {
+   if (m_writer) {
+      reportCompression();
+      if (m_budget && nbytes > 0) {
+         std::shared_ptr<WritingBytes>
+            writing(new WritingBytes(*m_budget, nbytes));
+         m_writer->submit([task, writing]() {task();});
+      } else {
+         m_writer->submit(task);
+      }
+   } else {
+      task();
+      reportCompression();
+   }
+}
+
+void ContainerBase::waitForWrites() {
+   if (m_writer) {
+      m_writer->wait();
+   }
+   reportCompression();
+}
+
+std::string ContainerBase::finalFileName(const std::string & fileName) const {
+   if (m_compress) {
+      return fileName + ".gz";
+   }
+   return fileName;
+}
+
+void ContainerBase::compressFile(const std::string & fileName) const {
+   if (!m_compress) {
+      return;
+   }
+   CompressionReport report;
+   report.fileName = finalFileName(fileName);
+   std::chrono::steady_clock::time_point 
+      start(std::chrono::steady_clock::now());
+   gzipFile(fileName, report.fileName, report.inputBytes, report.outputBytes);
+   std::chrono::duration<double> elapsed(std::chrono::steady_clock::now() 
+                                         - start);
+   report.seconds = elapsed.count();
+   if (std::remove(fileName.c_str()) != 0) {
+      throw std::runtime_error("ContainerBase::compressFile: "
+                               "cannot remove " + fileName);
+   }
+   std::lock_guard<std::mutex> lock(m_compressedMutex);
+   m_compressed.push_back(report);
+}
+
+void ContainerBase::reportCompression() {
+   std::vector<CompressionReport> reports;
+   {
+      std::lock_guard<std::mutex> lock(m_compressedMutex);
+      reports.swap(m_compressed);
+   }
+   if (reports.empty()) {
+      return;
+   }
+   st_stream::StreamFormatter formatter("ContainerBase", "", 2);
+   for (size_t i = 0; i < reports.size(); i++) {
+      const CompressionReport & report(reports[i]);
+      formatter.info() << "Compressed " << report.fileName << ": "
+                       << report.inputBytes/1024 << " kB to "
+                       << report.outputBytes/1024 << " kB";
+      if (report.outputBytes > 0) {
+         formatter.info() << ", ratio " 
+                          << roundTo(static_cast<double>(report.inputBytes)
+                                     /report.outputBytes, 0.01);
+      }
+      if (report.seconds > 0) {
+         formatter.info() << ", " 
+                          << roundTo(report.inputBytes/1048576.
+                                     /report.seconds, 0.1) << " MB/s";
+      }
+      formatter.info() << std::endl;
+   }
+}
+
+void ContainerBase::writeMemoryKeywords(tip::Header & header) const {
+   if (!m_budget) {
+      return;
+   }
+   header["MEMBUDGT"].set(static_cast<double>(m_budget->maxBytes()));
+   header["PEAKBUF"].set(static_cast<double>(m_budget->peakBytes()));
+   header["PEAKRSS"].set(static_cast<double>(MemoryBudget::peakRss()));
+}
+
 std::string ContainerBase::outputFileName() const {
    std::ostringstream outputfile;
    outputfile << m_filename;
@@ -39,19 +288,15 @@ void ContainerBase::writeDateKeywords(tip::Extension * table,
                                       double start_time, 
                                       double stop_time,
                                       bool extension) {
-   static double secsPerDay(8.64e4);
    tip::Header & header = table->getHeader();
    astro::JulianDate current_time = currentTime();
    try {
       header["DATE"].set(current_time.getGregorianDate());
    } catch (...) {
    }
-   astro::JulianDate mission_start(2006, 12, 31, 23.99888);
-   astro::JulianDate date_start(mission_start + start_time/secsPerDay);
-   astro::JulianDate date_stop(mission_start + stop_time/secsPerDay);
    try {
-      header["DATE-OBS"].set(date_start.getGregorianDate());
-      header["DATE-END"].set(date_stop.getGregorianDate());
+      header["DATE-OBS"].set(missionDate(start_time));
+      header["DATE-END"].set(missionDate(stop_time));
    } catch (...) {
    }
    if (extension) {
@@ -64,6 +309,20 @@ void ContainerBase::writeDateKeywords(tip::Extension * table,
    }
 }
 
+void ContainerBase::writePhduDateKeywords(FitsHandle & fits,
+                                          double start_time,
+                                          double stop_time) {
+   fitsfile * fptr(fits.fptr());
+   int status(0);
+   fits_movabs_hdu(fptr, 1, 0, &status);
+   checkFitsStatus(status, "Cannot move to the primary HDU");
+   updateKey(fptr, "DATE", currentTime().getGregorianDate());
+   updateKey(fptr, "DATE-OBS", missionDate(start_time));
+   updateKey(fptr, "DATE-END", missionDate(stop_time));
+   updateKey(fptr, "TSTART", start_time);
+   updateKey(fptr, "TSTOP", stop_time);
+}
+
 astro::JulianDate ContainerBase::currentTime() {
    std::time_t my_time = std::time(0);
    std::tm * now = std::gmtime(&my_time);
@@ -12,7 +12,7 @@
 
 namespace observationSim {
 
-CLHEP::HepRotation EgretSc::InstrumentToCelestial(double) {
+void EgretSc::computeRotation() {
 
 // This implementation *should* ensure that an orthogonal set of axes
 // are fed to the HepRotation constructor.
@@ -20,7 +20,7 @@ CLHEP::HepRotation EgretSc::InstrumentToCelestial(double) {
    CLHEP::Hep3Vector x_axis = m_xAxis();
    CLHEP::Hep3Vector yAxis = z_axis.cross(x_axis);
 
-   return CLHEP::HepRotation(yAxis.cross(z_axis), yAxis, z_axis);
+   m_rotation = CLHEP::HepRotation(yAxis.cross(z_axis), yAxis, z_axis);
 }
 
 } // namespace observationSim
@@ -36,13 +36,17 @@ public:
    EgretSc(astro::SkyDir &zAxis, astro::SkyDir &xAxis, 
            double earthLon, double earthLat, bool inSaa) :
       m_zAxis(zAxis), m_xAxis(xAxis), m_earthLon(earthLon),
-      m_earthLat(earthLat), m_inSaa(inSaa) {}
+      m_earthLat(earthLat), m_inSaa(inSaa) {
+      computeRotation();
+   }
 
    EgretSc(double raz, double decz, double rax, double decx,
            double earthLon, double earthLat, bool inSaa) :
       m_zAxis(astro::SkyDir(raz, decz, astro::SkyDir::EQUATORIAL)), 
       m_xAxis(astro::SkyDir(rax, decx, astro::SkyDir::EQUATORIAL)), 
-      m_earthLon(earthLon), m_earthLat(earthLat), m_inSaa(inSaa) {}
+      m_earthLon(earthLon), m_earthLat(earthLat), m_inSaa(inSaa) {
+      computeRotation();
+   }
 
    virtual ~EgretSc() {}
 
@@ -52,7 +56,9 @@ public:
    virtual double EarthLon(double) {return m_earthLon;}
    virtual double EarthLat(double) {return m_earthLat;}
 
-   virtual CLHEP::HepRotation InstrumentToCelestial(double);
+   virtual CLHEP::HepRotation InstrumentToCelestial(double) {
+      return m_rotation;
+   }
 
    virtual bool inSaa(double) {return m_inSaa;}
 
@@ -77,6 +83,12 @@ private:
    double m_earthLat;
    bool m_inSaa;
 
+   /// The instrument-to-celestial rotation, computed once from the
+   /// fixed axes.
+   CLHEP::HepRotation m_rotation;
+
+   void computeRotation();
+
 };
 
 } // namespace observationSim
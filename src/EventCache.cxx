@@ -0,0 +1,234 @@
+/**
+ * @file EventCache.cxx
+ * @brief Implementation of the per-source event cache files.
+ *
+ * $Header$
+ */
+
+#include <cstdio>
+#include <cstring>
+
+#include <stdexcept>
+
+#include "observationSim/Event.h"
+
+#include "EventCache.h"
+#include "TempFileName.h"
+
+namespace {
+   const char s_magic[8] = {'O', 'S', 'E', 'V', 'C', 'A', 'C', 'H'};
+   const char s_endMark[8] = {'O', 'S', 'E', 'V', 'C', 'E', 'N', 'D'};
+
+/// Written in native byte order, so that files from a machine of the
+/// other endianness are recognized.
+   const unsigned int s_byteOrder(0x01020304);
+
+   void setVector(const astro::SkyDir & dir, double * vec) {
+      vec[0] = dir.dir().x();
+      vec[1] = dir.dir().y();
+      vec[2] = dir.dir().z();
+   }
+
+   astro::SkyDir skyDir(const double * vec) {
+      return astro::SkyDir(CLHEP::Hep3Vector(vec[0], vec[1], vec[2]),
+                           astro::SkyDir::EQUATORIAL);
+   }
+
+   template <typename T>
+   void writeValue(std::ostream & output, const T & value) {
+      output.write(reinterpret_cast<const char *>(&value), sizeof(T));
+   }
+
+   template <typename T>
+   void readValue(std::istream & input, T & value) {
+      input.read(reinterpret_cast<char *>(&value), sizeof(T));
+   }
+} // anonymous namespace
+
+namespace observationSim {
+
+const unsigned int EventCacheWriter::s_formatVersion;
+
+EventCacheWriter::EventCacheWriter(const std::string & filename) 
+   : m_filename(filename), m_tmpfile(tempFileName(filename)),
+     m_output(m_tmpfile.c_str(), std::ios::out | std::ios::binary),
+     m_lastIndex(0), m_closed(false) {
+   if (!m_output) {
+      throw std::runtime_error("Cannot write event cache file " + m_tmpfile);
+   }
+   m_output.write(s_magic, sizeof(s_magic));
+   writeValue(m_output, s_formatVersion);
+   writeValue(m_output, s_byteOrder);
+   unsigned int recordSize(sizeof(EventCacheRecord));
+   writeValue(m_output, recordSize);
+}
+
+EventCacheWriter::~EventCacheWriter() {
+   if (!m_closed) {
+      m_output.close();
+      std::remove(m_tmpfile.c_str());
+   }
+}
+
+unsigned int EventCacheWriter::nameIndex(const std::string & srcName) {
+// Most photons come from the same source as the previous one.
+   if (m_lastIndex < m_names.size() && m_names[m_lastIndex] == srcName) {
+      return m_lastIndex;
+   }
+   std::map<std::string, unsigned int>::const_iterator 
+      item(m_nameIndices.find(srcName));
+   if (item == m_nameIndices.end()) {
+      item = m_nameIndices.insert(std::make_pair(srcName, m_names.size()))
+         .first;
+      m_names.push_back(srcName);
+   }
+   m_lastIndex = item->second;
+   return m_lastIndex;
+}
+
+void EventCacheWriter::addName(const std::string & srcName) {
+   nameIndex(srcName);
+}
+
+void EventCacheWriter::addEvent(const Event & event,
+                                const std::string & srcName) {
+   EventCacheRecord record;
+   std::memset(&record, 0, sizeof(record));
+   record.time = event.time();
+   record.energy = event.energy();
+   record.trueEnergy = event.trueEnergy();
+   record.fluxTheta = event.fluxTheta();
+   record.fluxPhi = event.fluxPhi();
+   setVector(event.appDir(), record.appDir);
+   setVector(event.srcDir(), record.srcDir);
+   setVector(event.zAxis(), record.zAxis);
+   setVector(event.xAxis(), record.xAxis);
+   setVector(event.zenith(), record.zenith);
+   record.eventType = event.eventType();
+   record.eventClass = event.eventClass();
+   record.convType = event.conversionType();
+   record.nameIndex = nameIndex(srcName);
+   writeValue(m_output, record);
+}
+
+void EventCacheWriter::
+close(const std::map<std::string, EventContainer::SourceSummary> & summaries) {
+   unsigned long long end(m_output.tellp());
+   writeValue(m_output, static_cast<unsigned int>(m_names.size()));
+   for (size_t i = 0; i < m_names.size(); i++) {
+      unsigned long long incident(0);
+      std::map<std::string, EventContainer::SourceSummary>::const_iterator
+         summary(summaries.find(m_names[i]));
+      if (summary != summaries.end()) {
+         incident = summary->second.incidentNum;
+      }
+      writeValue(m_output, static_cast<unsigned int>(m_names[i].size()));
+      m_output.write(m_names[i].c_str(), m_names[i].size());
+      writeValue(m_output, incident);
+   }
+   writeValue(m_output, end);
+   m_output.write(s_endMark, sizeof(s_endMark));
+   m_output.close();
+   if (!m_output || std::rename(m_tmpfile.c_str(), m_filename.c_str()) != 0) {
+      std::remove(m_tmpfile.c_str());
+      throw std::runtime_error("Cannot write event cache file " 
+                               + m_filename);
+   }
+   m_closed = true;
+}
+
+CachedEventFeed::CachedEventFeed(const std::string & filename) 
+   : m_input(filename.c_str(), std::ios::in | std::ios::binary),
+     m_begin(0), m_end(0), m_haveRecord(false), m_flushed(false) {
+   char magic[sizeof(s_magic)];
+   unsigned int version(0);
+   unsigned int byteOrder(0);
+   unsigned int recordSize(0);
+   if (m_input) {
+      m_input.read(magic, sizeof(magic));
+      readValue(m_input, version);
+      readValue(m_input, byteOrder);
+      readValue(m_input, recordSize);
+      m_begin = m_input.tellg();
+   }
+   if (!m_input || std::memcmp(magic, s_magic, sizeof(magic)) != 0
+       || version != EventCacheWriter::s_formatVersion
+       || byteOrder != s_byteOrder
+       || recordSize != sizeof(EventCacheRecord)) {
+      throw std::runtime_error("Missing or incompatible event cache file "
+                               + filename);
+   }
+   char endMark[sizeof(s_endMark)];
+   unsigned long long end(0);
+   if (m_input) {
+      m_input.seekg(-static_cast<std::streamoff>(sizeof(end) 
+                                                 + sizeof(endMark)),
+                    std::ios::end);
+      readValue(m_input, end);
+      m_input.read(endMark, sizeof(endMark));
+   }
+   if (!m_input || std::memcmp(endMark, s_endMark, sizeof(endMark)) != 0) {
+      throw std::runtime_error("Missing or incomplete event cache file "
+                               + filename);
+   }
+   m_end = static_cast<std::streamoff>(end);
+   m_input.seekg(m_end);
+   unsigned int nnames(0);
+   readValue(m_input, nnames);
+   for (unsigned int i = 0; i < nnames && m_input; i++) {
+      unsigned int length(0);
+      readValue(m_input, length);
+      std::string name(length, ' ');
+      m_input.read(&name[0], length);
+      unsigned long long incident(0);
+      readValue(m_input, incident);
+      m_names.push_back(name);
+      m_incident.push_back(static_cast<unsigned long>(incident));
+   }
+   if (!m_input || m_end < m_begin) {
+      throw std::runtime_error("Corrupted event cache file " + filename);
+   }
+   m_input.seekg(m_begin);
+}
+
+bool CachedEventFeed::nextTime(double tmax, double & time) {
+   if (!m_haveRecord) {
+      if (m_input.tellg() >= m_end) {
+         return false;
+      }
+      readValue(m_input, m_record);
+      if (!m_input || m_record.nameIndex >= m_names.size()) {
+         throw std::runtime_error("Corrupted event cache file.");
+      }
+      m_haveRecord = true;
+   }
+   if (m_record.time >= tmax) {
+      return false;
+   }
+   time = m_record.time;
+   return true;
+}
+
+bool CachedEventFeed::addEvent(EventContainer & events) {
+   m_haveRecord = false;
+   int id(m_ids.at(m_record.nameIndex));
+   Event event(m_record.time, m_record.energy, skyDir(m_record.appDir),
+               skyDir(m_record.srcDir), skyDir(m_record.zAxis),
+               skyDir(m_record.xAxis), skyDir(m_record.zenith),
+               m_record.convType, m_record.eventType, m_record.trueEnergy,
+               m_record.fluxTheta, m_record.fluxPhi, id);
+   event.setEventClass(m_record.eventClass);
+   return events.addCachedEvent(event, m_names[m_record.nameIndex], id);
+}
+
+void CachedEventFeed::flush(EventContainer & events) {
+   if (m_flushed) {
+      return;
+   }
+   for (size_t i = 0; i < m_names.size(); i++) {
+      events.addIncidentPhotons(m_names[i], m_ids.at(i), m_incident[i]);
+   }
+   m_flushed = true;
+}
+
+} // namespace observationSim
@@ -0,0 +1,169 @@
+/**
+ * @file EventCache.h
+ * @brief Per-source files of accepted events, for reuse in later
+ * simulations.
+ *
+ * $Header$
+ */
+
+#ifndef observationSim_EventCache_h
+#define observationSim_EventCache_h
+
+#include <fstream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "observationSim/EventContainer.h"
+#include "observationSim/EventFeed.h"
+
+namespace observationSim {
+
+class Event;
+
+/**
+ * @struct EventCacheRecord
+ *
+ * @brief The binary record for each event in a cache file.  The files
+ * are only meant to be read on the machine that wrote them, so the
+ * native layout is used.  The file header records the format version,
+ * the record size and the byte order, and files that do not match are
+ * rejected.
+ */
+
+struct EventCacheRecord {
+   double time;
+   double energy;
+   double trueEnergy;
+   double fluxTheta;
+   double fluxPhi;
+   double appDir[3];
+   double srcDir[3];
+   double zAxis[3];
+   double xAxis[3];
+   double zenith[3];
+   unsigned long long eventType;
+   unsigned long long eventClass;
+   int convType;
+   unsigned int nameIndex;
+};
+
+/**
+ * @class EventCacheWriter
+ *
+ * @brief Write the accepted events from one source to a cache file.
+ *
+ * The file is written under a temporary name unique to the process
+ * and is only moved into place by close(...), so an interrupted
+ * simulation does not leave an incomplete cache and concurrent runs
+ * do not write to the same file.  The events follow a header giving
+ * the format version.  The events are followed by a table of the names
+ * of the source and its nested sources, with their numbers of
+ * incident photons.
+ */
+
+class EventCacheWriter {
+
+public:
+
+   /// The version of the file format.  This is also part of the
+   /// cache keys, so it must be increased whenever EventCacheRecord
+   /// or the file layout changes.
+   static const unsigned int s_formatVersion = 2;
+
+   EventCacheWriter(const std::string & filename);
+
+   /// Remove the temporary file if close(...) was not called.
+   ~EventCacheWriter();
+
+   /// Record that a photon from the named source was processed, so
+   /// that its incident count is saved.
+   void addName(const std::string & srcName);
+
+   void addEvent(const Event & event, const std::string & srcName);
+
+   /// Write the incident counts from the source summaries and move
+   /// the file into place.
+   void close(const std::map<std::string, 
+              EventContainer::SourceSummary> & summaries);
+
+private:
+
+   std::string m_filename;
+   std::string m_tmpfile;
+   std::ofstream m_output;
+
+   std::vector<std::string> m_names;
+   std::map<std::string, unsigned int> m_nameIndices;
+   unsigned int m_lastIndex;
+
+   bool m_closed;
+
+   unsigned int nameIndex(const std::string & srcName);
+
+   EventCacheWriter(const EventCacheWriter &);
+   EventCacheWriter & operator=(const EventCacheWriter &);
+
+};
+
+/**
+ * @class CachedEventFeed
+ *
+ * @brief Replay the events in a cache file written by
+ * EventCacheWriter.
+ */
+
+class CachedEventFeed : public EventFeed {
+
+public:
+
+   /// Open the cache file and read its table of source names.  A
+   /// std::runtime_error is thrown if the file does not exist, is
+   /// incomplete, or was written in another format or on a machine
+   /// with a different record layout.
+   CachedEventFeed(const std::string & filename);
+
+   /// Names of the source and its nested sources.
+   const std::vector<std::string> & names() const {
+      return m_names;
+   }
+
+   /// Set the ID numbers to be assigned to the events for each of the
+   /// names.
+   void setIds(const std::vector<int> & ids) {
+      m_ids = ids;
+   }
+
+   virtual bool nextTime(double tmax, double & time);
+
+   virtual bool addEvent(EventContainer & events);
+
+   virtual void flush(EventContainer & events);
+
+private:
+
+   std::ifstream m_input;
+
+   /// Offset of the first event, which follows the header.
+   std::streamoff m_begin;
+
+   /// Offset of the name table, which follows the last event.
+   std::streamoff m_end;
+
+   std::vector<std::string> m_names;
+   std::vector<unsigned long> m_incident;
+   std::vector<int> m_ids;
+
+   EventCacheRecord m_record;
+   bool m_haveRecord;
+
+   bool m_flushed;
+
+   CachedEventFeed(const CachedEventFeed &);
+   CachedEventFeed & operator=(const CachedEventFeed &);
+
+};
+
+} // namespace observationSim
+
+#endif // observationSim_EventCache_h
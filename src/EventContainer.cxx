@@ -11,6 +11,7 @@
 #include <cstdlib>
 
 #include <algorithm>
+#include <functional>
 #include <numeric>
 #include <sstream>
 #include <stdexcept>
@@ -28,21 +29,26 @@ using CLHEP::HepRotation;
 #include "astro/SkyDir.h"
 #include "astro/GPS.h"
 
+#include "tip/IFileSvc.h"
+#include "tip/Table.h"
+
 #include "fitsGen/Ft1File.h"
 
 #include "flux/EventSource.h"
 #include "flux/Spectrum.h"
 
-#include "st_facilities/FitsUtil.h"
-
+#include "irfInterface/IPsf.h"
 #include "irfInterface/Irfs.h"
 
 #include "dataSubselector/BitMaskCut.h"
 #include "dataSubselector/Cuts.h"
-#include "dataSubselector/Gti.h"
 
+#include "observationSim/AsyncWriter.h"
 #include "observationSim/EventContainer.h"
+#include "observationSim/MemoryBudget.h"
 #include "observationSim/Spacecraft.h"
+#include "ColumnWriter.h"
+#include "EventGeometry.h"
 
 namespace {
    double my_acos(double mu) {
@@ -104,10 +110,58 @@ namespace {
       }
    }
 
+/// Add the data subspace keywords of the GTI extension to those
+/// written for the cuts.
+   void addGtiDssKeywords(tip::Header & header) {
+      int nkeys(0);
+      try {
+         header["NDSKEYS"].get(nkeys);
+      } catch (...) {
+      }
+      nkeys++;
+      std::ostringstream index;
+      index << nkeys;
+      header["DSTYP" + index.str()].set(std::string("TIME"));
+      header["DSUNI" + index.str()].set(std::string("s"));
+      header["DSVAL" + index.str()].set(std::string("TABLE"));
+      header["DSREF" + index.str()].set(std::string(":GTI"));
+      header["NDSKEYS"].set(nkeys);
+   }
+
+/// Write the single interval of a file to its GTI extension, which
+/// is added if the template does not provide it.
+   void writeGti(fitsfile * fptr, double start_time, double stop_time) {
+      int status(0);
+      char extname[] = "GTI";
+      fits_movnam_hdu(fptr, BINARY_TBL, extname, 0, &status);
+      if (status == BAD_HDU_NUM) {
+         status = 0;
+         char start[] = "START";
+         char stop[] = "STOP";
+         char format[] = "1D";
+         char unit[] = "s";
+         char * ttype[] = {start, stop};
+         char * tform[] = {format, format};
+         char * tunit[] = {unit, unit};
+         fits_create_tbl(fptr, BINARY_TBL, 0, 2, ttype, tform, tunit,
+                         extname, &status);
+      }
+      observationSim::checkFitsStatus(status, "Cannot write the GTI");
+      observationSim::writeColumn(fptr, "START",
+                                  std::vector<double>(1, start_time));
+      observationSim::writeColumn(fptr, "STOP",
+                                  std::vector<double>(1, stop_time));
+      observationSim::updateKey(fptr, "ONTIME", stop_time - start_time);
+      observationSim::updateKey(fptr, "TSTART", start_time);
+      observationSim::updateKey(fptr, "TSTOP", stop_time);
+   }
+
 } // unnamed namespace
 
 namespace observationSim {
 
+const double EventContainer::s_psfLeakage(1e-4);
+
 EventContainer::EventContainer(const std::string & filename, 
                                const std::string & tablename,
                                dataSubselector::Cuts * cuts,
@@ -117,21 +171,41 @@ EventContainer::EventContainer(const std::string & filename,
                                const st_app::AppParGroup * pars) 
    : ContainerBase(filename, tablename, maxNumEvents, pars), m_prob(1), 
      m_cuts(cuts), m_startTime(startTime), m_stopTime(stopTime),
-     m_applyEdisp(applyEdisp) {
+     m_applyEdisp(applyEdisp), m_useRoi(false), m_roiRadius(M_PI),
+     m_roiRejected(0), m_outputRows(0), m_geometry(new EventGeometry()),
+     m_lastEvent(0, 0, astro::SkyDir(), astro::SkyDir(), astro::SkyDir(),
+                 astro::SkyDir(), astro::SkyDir(), 0) {
    init();
 }
 
 EventContainer::~EventContainer() {
-   if (m_events.size() > 0) {
+// The writes use the data members, so they must be finished even if
+// the file cannot be completed.
+   try {
+      close();
+   } catch (...) {
+      try {
+         waitForWrites();
+      } catch (...) {
+      }
+   }
+   delete m_geometry;
+}
+
+void EventContainer::close() {
+   if (m_buffer.size() > 0 || m_output) {
       writeEvents(m_stopTime);
    }
+   waitForWrites();
 }
 
 void EventContainer::init() {
-   m_events.clear();
+   m_buffer.clear();
    if (!m_cuts) {
+      m_outputCuts.reset(new dataSubselector::Cuts());
       return;
    }
+   m_outputCuts.reset(new dataSubselector::Cuts(*m_cuts));
    dataSubselector::BitMaskCut * evtClassCut(m_cuts->bitMaskCut("EVENT_CLASS"));
    if (evtClassCut) {
       m_eventClass = evtClassCut->mask();
@@ -144,7 +218,7 @@ void EventContainer::init() {
 bool EventContainer::addEvent(EventSource * event, 
                               std::vector<irfInterface::Irfs *> & respPtrs, 
                               Spacecraft * spacecraft,
-                              bool flush) {
+                              bool flush, bool live) {
    std::string particleType = event->particleName();
    double time = event->time();
    double energy = event->energy();
@@ -158,26 +232,41 @@ bool EventContainer::addEvent(EventSource * event,
       flux_phi += 2.*M_PI;
    }
 
-   HepRotation rotMatrix = spacecraft->InstrumentToCelestial(time);
-   astro::SkyDir sourceDir(rotMatrix(-launchDir), astro::SkyDir::EQUATORIAL);
-
-   astro::SkyDir zAxis = spacecraft->zAxis(time);
-   astro::SkyDir xAxis = spacecraft->xAxis(time);
-
    std::string srcName(event->name());
    int eventId(event->code());
 
+// The instrument axes are taken from the same rotation as the source
+// direction, so the attitude is evaluated once per photon.  For a
+// spacecraft with a constant attitude, the rotation is a stored one.
+   HepRotation rotMatrix = spacecraft->InstrumentToCelestial(time);
+   astro::SkyDir sourceDir(rotMatrix(-launchDir), astro::SkyDir::EQUATORIAL);
+   astro::SkyDir zAxis(rotMatrix(Hep3Vector(0, 0, 1)),
+                       astro::SkyDir::EQUATORIAL);
+   astro::SkyDir xAxis(rotMatrix(Hep3Vector(1, 0, 0)),
+                       astro::SkyDir::EQUATORIAL);
+
    setEventId(srcName, eventId);
 
+   if (m_useRoi && sourceDir.difference(m_roiCenter) > m_roiRadius) {
+// This photon cannot produce an event within the acceptance cone.
+      m_roiRejected++;
+      if (flush) {
+         writeEvents();
+      }
+      return false;
+   }
+
    m_srcSummaries[srcName].incidentNum += 1;
    if (respPtrs.empty()) { 
       // This case for pass-through irfs, i.e., the irfs=none option
       // for gtobssim.
-      m_events.push_back( Event(time, energy, 
-                                sourceDir, sourceDir, zAxis, xAxis,
-                                ScZenith(time), 0, 0, energy, flux_theta,
-                                flux_phi, m_srcSummaries[srcName].id) );
-      if (flush || m_events.size() >= m_maxNumEntries) {
+      if (fileRows() >= m_maxNumEntries) {
+         writeEvents();
+      }
+      bufferEvent(Event(time, energy, sourceDir, sourceDir, zAxis, xAxis,
+                        ScZenith(time), 0, 0, energy, flux_theta,
+                        flux_phi, m_srcSummaries[srcName].id));
+      if (flush) {
          writeEvents();
       }
       return true;
@@ -190,62 +279,304 @@ bool EventContainer::addEvent(EventSource * event,
    bool accepted(false);
    if ( (m_prob == 1 || RandFlat::shoot() < m_prob)
         && RandFlat::shoot() < ltfrac
-        && !spacecraft->inSaa(time) 
+        && (live || !spacecraft->inSaa(time))
         && (respPtr = ::drawRespPtr(respPtrs, event->totalArea()*1e4, 
                                     energy, sourceDir, zAxis, xAxis, time,
                                     ltfrac)) ) {
+      accepted = storeEvent(time, energy, sourceDir, zAxis, xAxis,
+                            flux_theta, flux_phi, respPtr, 
+                            source_apply_edisp, srcName);
+   }
+   if (flush) {
+      writeEvents();
+   }
+   return accepted;
+}
 
-      astro::SkyDir appDir 
-         = respPtr->psf()->appDir(energy, sourceDir, zAxis, xAxis, time);
-      double appEnergy(energy);
-      if (m_applyEdisp && source_apply_edisp) {
-         appEnergy =
-            respPtr->edisp()->appEnergy(energy, sourceDir, zAxis, xAxis, time);
-      }
+bool EventContainer::addDetectedEvent(double time, double energy,
+                                      const Hep3Vector & launchDir,
+                                      const astro::SkyDir & sourceDir,
+                                      irfInterface::Irfs * respPtr,
+                                      Spacecraft * spacecraft,
+                                      const std::string & srcName,
+                                      int eventId, bool applyEdisp) {
+   setEventId(srcName, eventId);
+   if (m_prob < 1 && RandFlat::shoot() >= m_prob) {
+      return false;
+   }
+   double flux_theta = ::my_acos(launchDir.z());
+   double flux_phi = atan2(launchDir.y(), launchDir.x());
+   if (flux_phi < 0) {
+      flux_phi += 2.*M_PI;
+   }
+   return storeEvent(time, energy, sourceDir, spacecraft->zAxis(time),
+                     spacecraft->xAxis(time), flux_theta, flux_phi,
+                     respPtr, applyEdisp, srcName);
+}
+
+bool EventContainer::addCachedEvent(const Event & event,
+                                    const std::string & srcName,
+                                    int eventId) {
+   setEventId(srcName, eventId);
+   return appendEvent(event, srcName);
+}
+
+void EventContainer::addMergedEvent(const Event & event,
+                                    const std::string & srcName,
+                                    int eventId) {
+   setEventId(srcName, eventId);
+   m_srcSummaries[srcName].incidentNum += 1;
+   appendEvent(event, srcName, false);
+}
+
+void EventContainer::addIncidentPhotons(const std::string & srcName,
+                                        int eventId, unsigned long nphot) {
+   setEventId(srcName, eventId);
+   m_srcSummaries[srcName].incidentNum += nphot;
+}
+
+bool EventContainer::storeEvent(double time, double energy,
+                                const astro::SkyDir & sourceDir,
+                                const astro::SkyDir & zAxis,
+                                const astro::SkyDir & xAxis,
+                                double flux_theta, double flux_phi,
+                                irfInterface::Irfs * respPtr,
+                                bool source_apply_edisp,
+                                const std::string & srcName) {
+   astro::SkyDir appDir 
+      = respPtr->psf()->appDir(energy, sourceDir, zAxis, xAxis, time);
+   double appEnergy(energy);
+   if (m_applyEdisp && source_apply_edisp) {
+      appEnergy =
+         respPtr->edisp()->appEnergy(energy, sourceDir, zAxis, xAxis, time);
+   }
+
+   std::map<std::string, double> evtParams;
+   evtParams["ENERGY"] = appEnergy;
+   evtParams["RA"] = appDir.ra();
+   evtParams["DEC"] = appDir.dec();
+   evtParams["CONVERSION_TYPE"] = respPtr->irfID() % 2;
+   if (m_cuts != 0 && !m_cuts->accept(evtParams)) {
+      return false;
+   }
+   int convType(0);
+   if (respPtr->irfID() == 1) {
+      convType = 1;
+   }
+   int eventType;
+   Event evt(time, appEnergy, appDir, sourceDir, zAxis, xAxis, ScZenith(time), 
+             convType, eventType=(1 << respPtr->irfID()),
+             energy, flux_theta, flux_phi, m_srcSummaries[srcName].id);
+   evt.setEventClass(m_eventClass);
+   return appendEvent(evt, srcName);
+}
+
+bool EventContainer::appendEvent(const Event & event,
+                                 const std::string & srcName,
+                                 bool applyDeadtime) {
+   double lat_deadtime(2.6e-5);
+   if (applyDeadtime && fileRows() > 0 &&
+       (event.time() - m_lastEvent.time()) < lat_deadtime) {
+      st_stream::StreamFormatter formatter("gtobssim", "", 3);
+      formatter.info() << "Interval between consecutive events is "
+                       << "less than the nominal LAT deadtime "
+                       << "(26 microseconds).\n"
+                       << "Removing this event from source "
+                       << srcName << " and MC_SRC_ID " 
+                       << event.eventId() << std::endl;
+      return false;
+   }
+   if (fileRows() >= m_maxNumEntries) {
+      writeEvents();
+   }
+   m_srcSummaries[srcName].acceptedNum += 1;
+   bufferEvent(event);
+   return true;
+}
+
+void EventContainer::bufferEvent(const Event & event) {
+   size_t nrows(m_maxNumEntries);
+   if (m_chunkRows > 0) {
+      nrows = std::min(nrows, static_cast<size_t>(m_chunkRows));
+   }
+   if (m_budget && m_budget->maxBytes() > 0) {
+      nrows = std::min(nrows, m_budget->maxBytes()/EventBuffer::rowBytes()
+                       + 1);
+   }
+   if (m_buffer.time.capacity() < nrows) {
+      m_buffer.reserve(nrows);
+   }
+   m_buffer.time.push_back(event.time());
+   m_buffer.energy.push_back(event.energy());
+// The direction columns are computed in blocks.  The event's zenith
+// was found for its arrival time when it was created, so the
+// spacecraft position need not be computed again.
+   m_geometry->add(event.appDir().dir(), event.zAxis().dir(),
+                   event.xAxis().dir(), event.zenith().dir());
+   if (m_geometry->full()) {
+      fillGeometry();
+   }
+   m_buffer.eventClass.push_back(event.eventClass());
+   m_buffer.eventType.push_back(event.eventType());
+   m_buffer.convType.push_back(event.conversionType());
+   m_buffer.eventId.push_back(event.eventId());
+   m_buffer.trueEnergy.push_back(event.trueEnergy());
+   m_lastEvent = event;
+   if (m_chunkRows > 0 && m_buffer.size() >= m_chunkRows) {
+      appendRows();
+   }
+   checkMemoryBudget();
+}
 
-      std::map<std::string, double> evtParams;
-      evtParams["ENERGY"] = appEnergy;
-      evtParams["RA"] = appDir.ra();
-      evtParams["DEC"] = appDir.dec();
-      evtParams["CONVERSION_TYPE"] = respPtr->irfID() % 2;
-      if (m_cuts == 0 || m_cuts->accept(evtParams)) {
-         double lat_deadtime(2.6e-5);
-         if (m_events.size() > 0 &&
-             (time - m_events.back().time()) < lat_deadtime) {
-            st_stream::StreamFormatter formatter("gtobssim", "", 3);
-            formatter.info() << "Interval between consecutive events is "
-                             << "less than the nominal LAT deadtime "
-                             << "(26 microseconds).\n"
-                             << "Removing this event from source "
-                             << srcName << " and MC_SRC_ID " 
-                             << eventId << std::endl;
-            accepted = false;
-         } else {
-            int convType(0);
-            if (respPtr->irfID() == 1) {
-               convType = 1;
+void EventContainer::EventBuffer::reserve(size_t n) {
+   time.reserve(n);
+   energy.reserve(n);
+   ra.reserve(n);
+   dec.reserve(n);
+   l.reserve(n);
+   b.reserve(n);
+   theta.reserve(n);
+   phi.reserve(n);
+   zenithAngle.reserve(n);
+   earthAzimuth.reserve(n);
+   eventClass.reserve(n);
+   eventType.reserve(n);
+   convType.reserve(n);
+   eventId.reserve(n);
+   trueEnergy.reserve(n);
+}
+
+void EventContainer::EventBuffer::clear() {
+   time.clear();
+   energy.clear();
+   ra.clear();
+   dec.clear();
+   l.clear();
+   b.clear();
+   theta.clear();
+   phi.clear();
+   zenithAngle.clear();
+   earthAzimuth.clear();
+   eventClass.clear();
+   eventType.clear();
+   convType.clear();
+   eventId.clear();
+   trueEnergy.clear();
+}
+
+void EventContainer::EventBuffer::swap(EventBuffer & other) {
+   time.swap(other.time);
+   energy.swap(other.energy);
+   ra.swap(other.ra);
+   dec.swap(other.dec);
+   l.swap(other.l);
+   b.swap(other.b);
+   theta.swap(other.theta);
+   phi.swap(other.phi);
+   zenithAngle.swap(other.zenithAngle);
+   earthAzimuth.swap(other.earthAzimuth);
+   eventClass.swap(other.eventClass);
+   eventType.swap(other.eventType);
+   convType.swap(other.convType);
+   eventId.swap(other.eventId);
+   trueEnergy.swap(other.trueEnergy);
+}
+
+void EventContainer::getColumn(const std::string & name,
+                               std::vector<double> & values) {
+   fillGeometry();
+   if (name == "TIME") {
+      values.assign(m_buffer.time.begin(), m_buffer.time.end());
+   } else if (name == "ENERGY") {
+      values.assign(m_buffer.energy.begin(), m_buffer.energy.end());
+   } else if (name == "RA") {
+      values.assign(m_buffer.ra.begin(), m_buffer.ra.end());
+   } else if (name == "DEC") {
+      values.assign(m_buffer.dec.begin(), m_buffer.dec.end());
+   } else if (name == "L") {
+      values.assign(m_buffer.l.begin(), m_buffer.l.end());
+   } else if (name == "B") {
+      values.assign(m_buffer.b.begin(), m_buffer.b.end());
+   } else if (name == "THETA") {
+      values.assign(m_buffer.theta.begin(), m_buffer.theta.end());
+   } else if (name == "PHI") {
+      values.assign(m_buffer.phi.begin(), m_buffer.phi.end());
+   } else if (name == "ZENITH_ANGLE") {
+      values.assign(m_buffer.zenithAngle.begin(),
+                    m_buffer.zenithAngle.end());
+   } else if (name == "EARTH_AZIMUTH_ANGLE") {
+      values.assign(m_buffer.earthAzimuth.begin(),
+                    m_buffer.earthAzimuth.end());
+   } else {
+      throw std::invalid_argument("EventContainer::getColumn: "
+                                  "column " + name + " is not available");
+   }
+}
+
+std::vector<Event> EventContainer::getEvents() {
+   fillGeometry();
+   std::vector<Event> events;
+   events.reserve(m_buffer.size());
+   for (size_t i = 0; i < m_buffer.size(); i++) {
+      astro::SkyDir appDir(m_buffer.ra[i], m_buffer.dec[i]);
+      Hep3Vector dir(appDir());
+      Hep3Vector u(dir.orthogonal().unit());
+      Hep3Vector v(dir.cross(u));
+// Instrument axes for which the apparent direction has the buffered
+// inclination and azimuth.
+      double theta(m_buffer.theta[i]*M_PI/180.);
+      double phi(m_buffer.phi[i]*M_PI/180.);
+      Hep3Vector zAxis(std::cos(theta)*dir + std::sin(theta)*u);
+      Hep3Vector p(std::sin(theta)*dir - std::cos(theta)*u);
+      Hep3Vector q(zAxis.cross(p));
+      Hep3Vector xAxis(std::cos(phi)*p - std::sin(phi)*q);
+      double zenAngle(m_buffer.zenithAngle[i]*M_PI/180.);
+      Hep3Vector zenith(std::cos(zenAngle)*dir + std::sin(zenAngle)*v);
+      Event event(m_buffer.time[i], m_buffer.energy[i], appDir, appDir,
+                  astro::SkyDir(zAxis, astro::SkyDir::EQUATORIAL),
+                  astro::SkyDir(xAxis, astro::SkyDir::EQUATORIAL),
+                  astro::SkyDir(zenith, astro::SkyDir::EQUATORIAL),
+                  m_buffer.convType[i], m_buffer.eventType[i],
+                  m_buffer.trueEnergy[i], 0, 0, m_buffer.eventId[i]);
+      event.setEventClass(m_buffer.eventClass[i]);
+      events.push_back(event);
+   }
+   return events;
+}
+
+double EventContainer::
+psfMargin(const std::vector<irfInterface::Irfs *> & respPtrs,
+          double energy, double maxMargin) {
+   if (respPtrs.empty()) {
+// No PSF is applied.
+      return 0;
+   }
+   const double fraction(1. - s_psfLeakage);
+   double margin(0);
+   for (size_t i = 0; i < respPtrs.size(); i++) {
+      irfInterface::IPsf * psf(respPtrs[i]->psf());
+      for (double theta = 0; theta <= 70.; theta += 10.) {
+         if (psf->angularIntegral(energy, theta, 0, margin) >= fraction) {
+            continue;
+         }
+         if (psf->angularIntegral(energy, theta, 0, maxMargin) < fraction) {
+// Any smaller padding could lose photons, so nothing is discarded.
+            return 180.;
+         }
+         double lo(margin);
+         double hi(maxMargin);
+         while (hi - lo > 0.1) {
+            double radius((lo + hi)/2.);
+            if (psf->angularIntegral(energy, theta, 0, radius) < fraction) {
+               lo = radius;
+            } else {
+               hi = radius;
             }
-            int eventType;
-            m_srcSummaries[srcName].acceptedNum += 1;
-            m_events.push_back( Event(time, appEnergy, 
-                                      appDir, sourceDir, 
-                                      zAxis, xAxis, ScZenith(time), 
-                                      convType,
-                                      eventType=(1 << respPtr->irfID()),
-                                      energy, flux_theta, flux_phi,
-                                      m_srcSummaries[srcName].id) );
-            m_events.back().setEventClass(m_eventClass);
-            accepted = true;
          }
-      }
-      if (flush || m_events.size() >= m_maxNumEntries) {
-         writeEvents();
+         margin = hi;
       }
    }
-   if (flush) {
-      writeEvents();
-   }
-   return accepted;
+   return margin;
 }
 
 void EventContainer::setEventId(const std::string & name, int eventId) {
@@ -262,123 +593,183 @@ astro::SkyDir EventContainer::ScZenith(double time) const {
    return gps->zenithDir();
 }
 
-double EventContainer::earthAzimuthAngle(double ra, double dec, 
-                                         double time) const {
-   // Calculation from FT1worker::Evaluate in AnalysisNtuple package.
-   astro::SkyDir sdir(ra, dec);
-   astro::SkyDir zenith(ScZenith(time));
-
-   Hep3Vector north_pole(0,0,1);
-   // East is perp to north_pole and zenith
-   Hep3Vector east_dir(north_pole.cross(zenith()).unit());
-   Hep3Vector north_dir(zenith().cross(east_dir));
-
-   double earth_azimuth = atan2(sdir().dot(east_dir), sdir().dot(north_dir));
-   if (earth_azimuth < 0) {
-      earth_azimuth += 2*M_PI; // to 0-360 deg.
+void EventContainer::writeEvents(double obsStopTime) {
+   if (m_buffer.size() == 0 && !m_output) {
+      return;
    }
-   if (fabs(earth_azimuth) < 1e-8) {
-      earth_azimuth = 0;
+
+// Set stop time to be arrival time of last event if obsStopTime is
+// negative (i.e., not set);
+   double stop_time(m_lastEvent.time() - Spectrum::startTime());
+   if (obsStopTime > 0) {
+      stop_time = obsStopTime;
    }
-   earth_azimuth *= 180./M_PI;
-   return earth_azimuth;
-}
 
-void EventContainer::writeEvents(double obsStopTime) {
+   appendRows();
+   submitWrite(std::bind(&EventContainer::closeFile, this, m_output,
+                         m_startTime + Spectrum::startTime(),
+                         stop_time + Spectrum::startTime()));
+   m_output.reset();
+   m_outputRows = 0;
+
+// Update the m_fileNum index.
+   m_fileNum++;
 
-   std::string ft1File(outputFileName());
+// Set the start time for next output file to be current stop time.
+   m_startTime = stop_time;
+}
 
-   /// For backwards compatibility, use ft1_p7.tpl for Pass versions
-   /// prior to Pass 8, so that EVENT_CLASS is an 32-bit integer
-   /// instead of 32 bit-array
-   std::string ft1Template("ft1_p7.tpl");
-   dataSubselector::Cuts * cuts;
-   if (m_cuts) {
-      cuts = new dataSubselector::Cuts(*m_cuts);
-   } else {
-      cuts = new dataSubselector::Cuts();
+void EventContainer::fillGeometry() {
+   if (m_geometry->size() == 0) {
+      return;
    }
-   if (cuts->pass_ver().substr(0, 2) != "P7" && cuts->pass_ver() != "NONE") {
-      ft1Template = "ft1.tpl";
+   size_t first(m_buffer.ra.size());
+   size_t nrows(first + m_geometry->size());
+   m_buffer.ra.resize(nrows);
+   m_buffer.dec.resize(nrows);
+   m_buffer.l.resize(nrows);
+   m_buffer.b.resize(nrows);
+   m_buffer.theta.resize(nrows);
+   m_buffer.phi.resize(nrows);
+   m_buffer.zenithAngle.resize(nrows);
+   m_buffer.earthAzimuth.resize(nrows);
+   m_geometry->compute(&m_buffer.ra[first], &m_buffer.dec[first],
+                       &m_buffer.l[first], &m_buffer.b[first],
+                       &m_buffer.theta[first], &m_buffer.phi[first],
+                       &m_buffer.zenithAngle[first],
+                       &m_buffer.earthAzimuth[first]);
+}
+
+void EventContainer::appendRows() {
+   fillGeometry();
+   if (m_buffer.size() == 0) {
+      return;
    }
+   if (!m_output) {
+      m_output.reset(new Ft1Output());
+      m_output->fileName = outputFileName();
+      m_output->creatorName = creator();
+      m_output->cuts = m_outputCuts;
+// For backwards compatibility, use ft1_p7.tpl for Pass versions
+// prior to Pass 8, so that EVENT_CLASS is an 32-bit integer instead
+// of 32 bit-array.
+      const std::string & pass_ver(m_output->cuts->pass_ver());
+      m_output->bitEventClass = (pass_ver.substr(0, 2) != "P7" 
+                                 && pass_ver != "NONE");
+      submitWrite(std::bind(&EventContainer::createFile, this, m_output));
+   }
+// Hand the buffer to the writer and start a new one.
+   std::shared_ptr<EventBuffer> buffer(new EventBuffer());
+   buffer->swap(m_buffer);
+   m_outputRows += buffer->size();
+   submitWrite(std::bind(&EventContainer::writeRows, this, m_output, 
+                         buffer), buffer->size()*EventBuffer::rowBytes());
+}
 
-   fitsGen::Ft1File ft1(ft1File, m_events.size(), m_tablename,
-                        ft1Template);
+void EventContainer::
+createFile(const std::shared_ptr<Ft1Output> & output) const {
+   const std::string & ft1File(output->fileName);
+   fitsGen::Ft1File ft1(ft1File, 0, m_tablename,
+                        output->bitEventClass ? "ft1.tpl" : "ft1_p7.tpl");
    ft1.appendField("MC_SRC_ID", "1J");
    ft1.appendField("MCENERGY", "1E");
 
-   size_t my_count(0);
-   std::vector<Event>::iterator evt = m_events.begin();
-   for ( ; ft1.itor() != ft1.end() && evt != m_events.end(); 
-         ft1.next(), ++evt) {
-      double time = evt->time();
-      double ra = evt->appDir().ra();
-      double dec = evt->appDir().dec();
-
-      ft1["time"].set(time);
-      ft1["energy"].set(evt->energy());
-      ft1["ra"].set(ra);
-      ft1["dec"].set(dec);
-      ft1["l"].set(evt->appDir().l());
-      ft1["b"].set(evt->appDir().b());
-      ft1["theta"].set(evt->theta());
-      ft1["phi"].set(evt->phi());
-      ft1["zenith_angle"].set(evt->zenAngle());
-      ft1["earth_azimuth_angle"].set(earthAzimuthAngle(ra, dec, time));
-      if (ft1Template == "ft1_p7.tpl") {
-         int event_class(evt->eventClass());
-         ft1["event_class"].set(event_class);
-      } else {
-         tip::BitStruct event_class(evt->eventClass());
-         ft1["event_class"].set(event_class);
-      }
-      tip::BitStruct event_type(evt->eventType());
-      ft1["event_type"].set(event_type);
-      ft1["conversion_type"].set(evt->conversionType());
-      ft1["mc_src_id"].set(evt->eventId());
-      ft1["mcenergy"].set(evt->trueEnergy());
-      my_count++;
-   }
-// Set stop time to be arrival time of last event if obsStopTime is
-// negative (i.e., not set);
-   double stop_time(m_events.back().time() - Spectrum::startTime());
-   if (obsStopTime > 0) {
-      stop_time = obsStopTime;
-   }
-   ft1.setObsTimes(m_startTime + Spectrum::startTime(),
-                   stop_time + Spectrum::startTime());
-   
 // Write PASS_VER keyword.
-   ft1.header()["PASS_VER"].set(cuts->pass_ver());
-
-// Fill the GTI extension with the entire observation in a single GTI.
-   dataSubselector::Gti gti;
-   gti.insertInterval(m_startTime + Spectrum::startTime(),
-                      stop_time + Spectrum::startTime());
-   gti.writeExtension(ft1File);
+   ft1.header()["PASS_VER"].set(output->cuts->pass_ver());
 
-   cuts->addGtiCut(gti);
-   cuts->writeDssKeywords(ft1.header());
-
-   ft1.setPhduKeyword("FILENAME", ft1File);
+   ft1.setPhduKeyword("FILENAME", finalFileName(ft1File));
    ft1.setPhduKeyword("VERSION", 1);
-   ft1.setPhduKeyword("CREATOR", creator());
+   ft1.setPhduKeyword("CREATOR", output->creatorName);
 
    writeParFileParams(ft1.header());
 
    ft1.close();
 
-   cuts->writeGtiExtension(ft1File);
-   st_facilities::FitsUtil::writeChecksums(ft1File);
-   
-// Flush the Event buffer...
-   m_events.clear();
+   output->table = tip::IFileSvc::instance().editTable(ft1File, m_tablename);
+   output->fits.reset(new FitsHandle(ft1File, m_tablename));
+}
 
-// and update the m_fileNum index.
-   m_fileNum++;
+void EventContainer::
+closeFile(const std::shared_ptr<Ft1Output> & output,
+          double start_time, double stop_time) const {
+   const std::string & ft1File(output->fileName);
+   tip::Table * table(output->openTable());
+
+// The EVENTS headers are written through tip, as the cuts require.
+// The cuts are shared by all of the files, so the GTI of this file
+// is added to their data subspace keywords here.
+   writeDateKeywords(table, start_time, stop_time);
+   tip::Header & header(table->getHeader());
+   output->cuts->writeDssKeywords(header);
+   addGtiDssKeywords(header);
+   writeMemoryKeywords(header);
+   delete output->table;
+   output->table = 0;
+
+// The rest is written through the cfitsio handle, which has kept the
+// file open, with the checksums last.
+   FitsHandle & fits(*output->fits);
+   writePhduDateKeywords(fits, start_time, stop_time);
+   writeGti(fits.fptr(), start_time, stop_time);
+   writeChecksums(fits.fptr());
+   fits.close();
+   output->fits.reset();
+
+   compressFile(ft1File);
+}
 
-// Set the start time for next output file to be current stop time.
-   m_startTime = stop_time;
+tip::Table * EventContainer::Ft1Output::openTable() const {
+   if (table == 0) {
+      throw std::runtime_error("EventContainer: " + fileName
+                               + " is not open for writing.");
+   }
+   return table;
+}
+
+EventContainer::Ft1Output::Ft1Output()
+   : bitEventClass(false), table(0), nrows(0) {}
+
+EventContainer::Ft1Output::~Ft1Output() {
+// The last reference may be dropped in either thread.
+   std::lock_guard<std::recursive_mutex> lock(AsyncWriter::fitsMutex());
+   fits.reset();
+   delete table;
+}
+
+void EventContainer::
+writeRows(const std::shared_ptr<Ft1Output> & output,
+          const std::shared_ptr<EventBuffer> & events) const {
+   const EventBuffer & buffer(*events);
+   tip::Table * table(output->openTable());
+   tip::Index_t first(output->nrows);
+   output->nrows += buffer.size();
+   table->setNumRecords(output->nrows);
+
+// The rows are added through tip, so that its record count stays
+// current, and each column is then written with a single cfitsio
+// call.
+   fitsfile * fptr(output->fits->fptr());
+   writeColumn(fptr, "TIME", buffer.time, first);
+   writeColumn(fptr, "ENERGY", buffer.energy, first);
+   writeColumn(fptr, "RA", buffer.ra, first);
+   writeColumn(fptr, "DEC", buffer.dec, first);
+   writeColumn(fptr, "L", buffer.l, first);
+   writeColumn(fptr, "B", buffer.b, first);
+   writeColumn(fptr, "THETA", buffer.theta, first);
+   writeColumn(fptr, "PHI", buffer.phi, first);
+   writeColumn(fptr, "ZENITH_ANGLE", buffer.zenithAngle, first);
+   writeColumn(fptr, "EARTH_AZIMUTH_ANGLE", buffer.earthAzimuth, first);
+   if (output->bitEventClass) {
+      writeBitColumn(fptr, "EVENT_CLASS", buffer.eventClass, first);
+   } else {
+      std::vector<int> eventClass(buffer.eventClass.begin(),
+                                  buffer.eventClass.end());
+      writeColumn(fptr, "EVENT_CLASS", eventClass, first);
+   }
+   writeBitColumn(fptr, "EVENT_TYPE", buffer.eventType, first);
+   writeColumn(fptr, "CONVERSION_TYPE", buffer.convType, first);
+   writeColumn(fptr, "MC_SRC_ID", buffer.eventId, first);
+   writeColumn(fptr, "MCENERGY", buffer.trueEnergy, first);
 }
 
 } // namespace observationSim
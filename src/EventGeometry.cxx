@@ -0,0 +1,149 @@
+/**
+ * @file EventGeometry.cxx
+ * @brief Implementation of the block computation of the FT1 direction
+ * columns.
+ *
+ * $Header$
+ */
+
+#include <cmath>
+
+#include "astro/SkyDir.h"
+
+#include "EventGeometry.h"
+
+namespace {
+   const double degrees(180./M_PI);
+
+/// Rows of the rotation from equatorial to galactic coordinates.
+/// Column j is the galactic unit vector of the equatorial basis
+/// vector j, as given by astro::SkyDir.
+   struct GalacticRotation {
+      double matrix[3][3];
+      GalacticRotation() {
+         for (int j = 0; j < 3; j++) {
+            CLHEP::Hep3Vector axis(0, 0, 0);
+            axis[j] = 1;
+            astro::SkyDir dir(axis, astro::SkyDir::EQUATORIAL);
+            double l(dir.l()/degrees);
+            double b(dir.b()/degrees);
+            matrix[0][j] = std::cos(b)*std::cos(l);
+            matrix[1][j] = std::cos(b)*std::sin(l);
+            matrix[2][j] = std::sin(b);
+         }
+      }
+   };
+
+   const GalacticRotation & galacticRotation() {
+      static GalacticRotation rotation;
+      return rotation;
+   }
+
+/// Longitude (degrees, [0, 360)) and latitude (degrees) of a vector,
+/// as in SkyDir::ra() and SkyDir::dec().
+   void lonLat(const double * x, const double * y, const double * z,
+               std::size_t n, float * lon, float * lat) {
+      for (std::size_t i = 0; i < n; i++) {
+         double phi(std::atan2(y[i], x[i])*degrees);
+         lon[i] = phi < 0 ? phi + 360. : phi;
+         lat[i] = 90. - std::atan2(std::sqrt(x[i]*x[i] + y[i]*y[i]),
+                                   z[i])*degrees;
+      }
+   }
+
+   typedef observationSim::EventGeometry::Block_t Block_t;
+
+/// The angle (degrees) between two sets of unit vectors, as in
+/// SkyDir::difference().
+   void separation(const Block_t & u, const Block_t & v, std::size_t n,
+                   float * angle) {
+      for (std::size_t i = 0; i < n; i++) {
+         double dx(u[0][i] - v[0][i]);
+         double dy(u[1][i] - v[1][i]);
+         double dz(u[2][i] - v[2][i]);
+         angle[i] = 2.*std::asin(0.5*std::sqrt(dx*dx + dy*dy + dz*dz))
+            *degrees;
+      }
+   }
+}
+
+namespace observationSim {
+
+const std::size_t EventGeometry::s_blockSize;
+
+void EventGeometry::add(const CLHEP::Hep3Vector & appDir,
+                        const CLHEP::Hep3Vector & zAxis,
+                        const CLHEP::Hep3Vector & xAxis,
+                        const CLHEP::Hep3Vector & zenith) {
+   for (int k = 0; k < 3; k++) {
+      m_appDir[k][m_size] = appDir[k];
+      m_zAxis[k][m_size] = zAxis[k];
+      m_xAxis[k][m_size] = xAxis[k];
+      m_zenith[k][m_size] = zenith[k];
+   }
+   m_size++;
+}
+
+void EventGeometry::compute(float * ra, float * dec, float * l, float * b,
+                            float * theta, float * phi, float * zenithAngle,
+                            float * earthAzimuth) {
+   std::size_t n(m_size);
+   const double * ax(m_appDir[0]);
+   const double * ay(m_appDir[1]);
+   const double * az(m_appDir[2]);
+
+   lonLat(ax, ay, az, n, ra, dec);
+
+   const double (&rot)[3][3](galacticRotation().matrix);
+   Block_t gal;
+   for (int k = 0; k < 3; k++) {
+      for (std::size_t i = 0; i < n; i++) {
+         gal[k][i] = rot[k][0]*ax[i] + rot[k][1]*ay[i] + rot[k][2]*az[i];
+      }
+   }
+   lonLat(gal[0], gal[1], gal[2], n, l, b);
+
+   separation(m_appDir, m_zAxis, n, theta);
+   separation(m_zenith, m_appDir, n, zenithAngle);
+
+// Azimuth wrt the instrument x-axis, with y = z x x.
+   for (std::size_t i = 0; i < n; i++) {
+      double zx(m_zAxis[0][i]), zy(m_zAxis[1][i]), zz(m_zAxis[2][i]);
+      double xx(m_xAxis[0][i]), xy(m_xAxis[1][i]), xz(m_xAxis[2][i]);
+      double yx(zy*xz - zz*xy);
+      double yy(zz*xx - zx*xz);
+      double yz(zx*xy - zy*xx);
+      double value(std::atan2(ax[i]*yx + ay[i]*yy + az[i]*yz,
+                              ax[i]*xx + ay[i]*xy + az[i]*xz)*degrees);
+      phi[i] = value < 0 ? value + 360. : value;
+   }
+
+// Earth azimuth, measured from north through east in the local
+// horizontal plane, from FT1worker::Evaluate in AnalysisNtuple.  East
+// is perpendicular to the north pole and the zenith.
+   for (std::size_t i = 0; i < n; i++) {
+      double zx(m_zenith[0][i]), zy(m_zenith[1][i]), zz(m_zenith[2][i]);
+      double norm(std::sqrt(zx*zx + zy*zy));
+      double ex(0), ey(0);
+      if (norm > 0) {
+         ex = -zy/norm;
+         ey = zx/norm;
+      }
+      double nx(-zz*ey);
+      double ny(zz*ex);
+      double nz(zx*ey - zy*ex);
+      double value(std::atan2(ax[i]*ex + ay[i]*ey,
+                              ax[i]*nx + ay[i]*ny + az[i]*nz));
+      if (value < 0) {
+         value += 2*M_PI;
+      }
+      if (std::fabs(value) < 1e-8) {
+         value = 0;
+      }
+      earthAzimuth[i] = value*degrees;
+   }
+
+   m_size = 0;
+}
+
+} // namespace observationSim
@@ -0,0 +1,98 @@
+/**
+ * @file EventGeometry.h
+ * @brief Block computation of the FT1 direction columns.
+ *
+ * $Header$
+ */
+
+#ifndef observationSim_EventGeometry_h
+#define observationSim_EventGeometry_h
+
+#include <cstddef>
+
+#include "CLHEP/Vector/ThreeVector.h"
+
+namespace observationSim {
+
+/**
+ * @class EventGeometry
+ *
+ * @brief Compute RA, DEC, L, B, THETA, PHI, ZENITH_ANGLE and
+ * EARTH_AZIMUTH_ANGLE for a block of events from the unit vectors of
+ * their apparent directions, instrument axes and zeniths.
+ *
+ * Doing this per event through the astro::SkyDir accessors rotates
+ * each direction to galactic coordinates and builds the instrument
+ * y-axis and the local east and north directions as separate vector
+ * temporaries.  Here the unit vectors are staged in arrays, one per
+ * component, and each quantity is computed for the whole block in a
+ * loop that the compiler can vectorize, with the galactic rotation
+ * matrix found once.  The formulae are those of astro::SkyDir, so the
+ * single precision column values agree with the per-event ones to
+ * within one unit in the last place.
+ */
+
+class EventGeometry {
+
+public:
+
+   static const std::size_t s_blockSize = 256;
+
+   /// The x, y and z components of a block of vectors.
+   typedef double Block_t[3][s_blockSize];
+
+   EventGeometry() : m_size(0) {}
+
+   std::size_t size() const {
+      return m_size;
+   }
+
+   bool full() const {
+      return m_size == s_blockSize;
+   }
+
+   /// Stage an event.  The block must not be full.
+   void add(const CLHEP::Hep3Vector & appDir,
+            const CLHEP::Hep3Vector & zAxis,
+            const CLHEP::Hep3Vector & xAxis,
+            const CLHEP::Hep3Vector & zenith);
+
+   /// The directions of the staged event i.
+   CLHEP::Hep3Vector appDir(std::size_t i) const {
+      return vector(m_appDir, i);
+   }
+   CLHEP::Hep3Vector zAxis(std::size_t i) const {
+      return vector(m_zAxis, i);
+   }
+   CLHEP::Hep3Vector xAxis(std::size_t i) const {
+      return vector(m_xAxis, i);
+   }
+   CLHEP::Hep3Vector zenith(std::size_t i) const {
+      return vector(m_zenith, i);
+   }
+
+   /// Write the angles (degrees) of the staged events to the arrays,
+   /// which must each have room for size() values, and empty the
+   /// block.
+   void compute(float * ra, float * dec, float * l, float * b,
+                float * theta, float * phi, float * zenithAngle,
+                float * earthAzimuth);
+
+private:
+
+   std::size_t m_size;
+
+   Block_t m_appDir;
+   Block_t m_zAxis;
+   Block_t m_xAxis;
+   Block_t m_zenith;
+
+   static CLHEP::Hep3Vector vector(const Block_t & block, std::size_t i) {
+      return CLHEP::Hep3Vector(block[0][i], block[1][i], block[2][i]);
+   }
+
+};
+
+} // namespace observationSim
+
+#endif // observationSim_EventGeometry_h
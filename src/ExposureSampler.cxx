@@ -0,0 +1,233 @@
+/**
+ * @file ExposureSampler.cxx
+ * @brief Implementation of the exposure-based event sampler for
+ * steady point sources.
+ *
+ * $Header$
+ */
+
+#include <cmath>
+
+#include <algorithm>
+#include <stdexcept>
+
+#include "CLHEP/Random/RandFlat.h"
+#include "CLHEP/Random/RandPoisson.h"
+
+#include "flux/EventSource.h"
+
+#include "irfInterface/Irfs.h"
+
+#include "observationSim/EventContainer.h"
+#include "observationSim/Spacecraft.h"
+
+#include "ExposureSampler.h"
+
+using CLHEP::RandFlat;
+using CLHEP::RandPoisson;
+
+namespace observationSim {
+
+size_t ExposureSampler::s_poolSize(4096);
+size_t ExposureSampler::s_nquantiles(16);
+size_t ExposureSampler::s_ncostheta(41);
+size_t ExposureSampler::s_nphi(8);
+double ExposureSampler::s_envelopeMargin(1.5);
+
+ExposureSampler::
+ExposureSampler(EventSource * source, const std::string & name, int id,
+                const astro::SkyDir & srcDir, double tstart, double binSize,
+                const std::vector<irfInterface::Irfs *> & respPtrs,
+                Spacecraft * spacecraft)
+   : m_source(source), m_name(name), m_id(id), m_srcDir(srcDir),
+     m_binStart(tstart), m_binSize(binSize), m_respPtrs(respPtrs),
+     m_spacecraft(spacecraft), m_applyEdisp(true),
+     m_area(EventSource::totalArea()*1e4), m_incident(0) {
+   if (m_respPtrs.empty()) {
+      throw std::invalid_argument("ExposureSampler: response functions "
+                                  "are required.");
+   }
+   if (m_binSize <= 0) {
+      throw std::invalid_argument("ExposureSampler: bin size must be "
+                                  "positive.");
+   }
+   fillEnergyPool(tstart);
+   fillAeffTable();
+}
+
+ExposureSampler::~ExposureSampler() {
+   delete m_source;
+}
+
+bool ExposureSampler::nextTime(double tmax, double & time) {
+   while (m_detections.empty() && m_binStart < tmax) {
+      sampleBin();
+   }
+   if (m_detections.empty() || m_detections.front().time >= tmax) {
+      return false;
+   }
+   time = m_detections.front().time;
+   return true;
+}
+
+bool ExposureSampler::addEvent(EventContainer & events) {
+   Detection detection(m_detections.front());
+   m_detections.pop_front();
+   flush(events);
+   CLHEP::HepRotation
+      rotMatrix(m_spacecraft->InstrumentToCelestial(detection.time));
+   CLHEP::Hep3Vector launchDir(-(rotMatrix.inverse()(m_srcDir())));
+   return events.addDetectedEvent(detection.time, detection.energy,
+                                  launchDir, m_srcDir,
+                                  m_respPtrs.at(detection.irfIndex),
+                                  m_spacecraft, m_name, m_id, m_applyEdisp);
+}
+
+void ExposureSampler::flush(EventContainer & events) {
+   events.addIncidentPhotons(m_name, m_id, m_incident);
+   m_incident = 0;
+}
+
+void ExposureSampler::fillEnergyPool(double time) {
+   m_energies.resize(s_poolSize);
+   for (size_t i = 0; i < s_poolSize; i++) {
+      EventSource * evt(m_source->event(time));
+      if (evt == 0) {
+         throw std::runtime_error("ExposureSampler: source " + m_name
+                                  + " did not provide any photons.");
+      }
+      m_energies[i] = evt->energy();
+      m_applyEdisp = evt->applyEdisp();
+   }
+   std::sort(m_energies.begin(), m_energies.end());
+}
+
+double ExposureSampler::nodeEnergy(size_t node) const {
+   return m_energies[std::min(node*s_poolSize/(2*s_nquantiles),
+                              s_poolSize - 1)];
+}
+
+void ExposureSampler::fillAeffTable() {
+   size_t nirfs(m_respPtrs.size());
+   size_t nnodes(2*s_nquantiles + 1);
+   m_aeff.resize(nirfs*nnodes*s_ncostheta);
+   m_weights.resize(nirfs*s_nquantiles);
+   size_t indx(0);
+   for (size_t irf = 0; irf < nirfs; irf++) {
+      for (size_t node = 0; node < nnodes; node++) {
+         double energy(nodeEnergy(node));
+         for (size_t i = 0; i < s_ncostheta; i++, indx++) {
+            double costheta(static_cast<double>(i)/(s_ncostheta - 1));
+            double theta(std::acos(costheta)*180./M_PI);
+            double aeff(0);
+// The azimuthal dependence has a four-fold symmetry.
+            for (size_t j = 0; j < s_nphi; j++) {
+               double phi(90.*j/s_nphi);
+               aeff += m_respPtrs[irf]->aeff()->value(energy, theta, phi);
+            }
+            m_aeff[indx] = aeff/s_nphi;
+         }
+      }
+   }
+}
+
+double ExposureSampler::envelope(size_t irf, size_t quantile,
+                                 double cosmin, double cosmax) const {
+// The grid points bracketing the range of cos(inclination).
+   size_t first(0);
+   if (cosmin > 0) {
+      first = std::min(static_cast<size_t>(cosmin*(s_ncostheta - 1)),
+                       s_ncostheta - 1);
+   }
+   size_t last(std::min(static_cast<size_t>(std::ceil(cosmax*(s_ncostheta
+                                                              - 1))),
+                        s_ncostheta - 1));
+   size_t nnodes(2*s_nquantiles + 1);
+   double value(0);
+   for (size_t node = 2*quantile; node <= 2*quantile + 2; node++) {
+      const double * table(&m_aeff[(irf*nnodes + node)*s_ncostheta]);
+      for (size_t i = first; i <= last; i++) {
+         value = std::max(value, table[i]);
+      }
+   }
+   return value*s_envelopeMargin;
+}
+
+double ExposureSampler::drawEnergy(size_t quantile) const {
+// Interpolate logarithmically between adjacent energies in the pool
+// so that the drawn energies are not restricted to the pool values.
+   double x((quantile + RandFlat::shoot())*s_poolSize/s_nquantiles);
+   size_t i(std::min(static_cast<size_t>(x), s_poolSize - 1));
+   size_t j(std::min(i + 1, s_poolSize - 1));
+   return m_energies[i]*std::pow(m_energies[j]/m_energies[i], x - i);
+}
+
+void ExposureSampler::sampleBin() {
+   double tstart(m_binStart);
+   m_binStart += m_binSize;
+
+   double nincident(m_source->rate(tstart + m_binSize/2.)*m_binSize);
+   double cosmin(1);
+   double cosmax(-1);
+   for (size_t i = 0; i < 3; i++) {
+      double time(tstart + i*m_binSize/2.);
+      double costheta(m_srcDir().dot(m_spacecraft->zAxis(time)()));
+      cosmin = std::min(cosmin, costheta);
+      cosmax = std::max(cosmax, costheta);
+   }
+   double ncandidates(0);
+   if (cosmax > 0) {
+      double total(0);
+      for (size_t irf = 0, indx = 0; irf < m_respPtrs.size(); irf++) {
+         for (size_t k = 0; k < s_nquantiles; k++, indx++) {
+            total += envelope(irf, k, cosmin, cosmax);
+            m_weights[indx] = total;
+         }
+      }
+      ncandidates = nincident*total/s_nquantiles/m_area;
+   }
+   long ndraws(0);
+   if (ncandidates > 0) {
+      ndraws = RandPoisson::shoot(ncandidates);
+   }
+// The incident photons comprise the candidates and the photons
+// outside the envelope, which are independently Poisson distributed.
+   m_incident += ndraws;
+   if (nincident > ncandidates) {
+      m_incident += RandPoisson::shoot(nincident - ncandidates);
+   }
+   const irfInterface::IEfficiencyFactor * efficiency_factor
+      = m_respPtrs.front()->efficiencyFactor();
+   for (long i = 0; i < ndraws; i++) {
+      double time(tstart + RandFlat::shoot()*m_binSize);
+      double xi(RandFlat::shoot()*m_weights.back());
+      size_t indx(std::upper_bound(m_weights.begin(), m_weights.end(), xi)
+                  - m_weights.begin());
+      indx = std::min(indx, m_weights.size() - 1);
+      size_t irf(indx/s_nquantiles);
+      double energy(drawEnergy(indx % s_nquantiles));
+// Accept the candidate with the probability that the photon
+// simulation would detect it, relative to the envelope.  The
+// livetime fraction is that at the arrival time, so that bins which
+// straddle an SAA boundary are handled.
+      if (m_spacecraft->inSaa(time)) {
+         continue;
+      }
+      double ltfrac(m_spacecraft->livetimeFrac(time));
+      double aeff(m_respPtrs[irf]->aeff()->value(energy, m_srcDir,
+                                                 m_spacecraft->zAxis(time),
+                                                 m_spacecraft->xAxis(time),
+                                                 time));
+      if (efficiency_factor) {
+         aeff *= efficiency_factor->value(energy, ltfrac, time);
+      }
+      double bound(m_weights[indx] - (indx > 0 ? m_weights[indx - 1] : 0));
+      if (RandFlat::shoot()*bound >= ltfrac*aeff) {
+         continue;
+      }
+      m_detections.push_back(Detection(time, energy, irf));
+   }
+   std::sort(m_detections.begin(), m_detections.end());
+}
+
+} // namespace observationSim
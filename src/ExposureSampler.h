@@ -0,0 +1,166 @@
+/**
+ * @file ExposureSampler.h
+ * @brief Event feed that samples the detected events of a steady
+ * point source directly from its exposure.
+ *
+ * $Header$
+ */
+
+#ifndef observationSim_ExposureSampler_h
+#define observationSim_ExposureSampler_h
+
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "astro/SkyDir.h"
+
+#include "observationSim/EventFeed.h"
+
+class EventSource;
+
+namespace irfInterface {
+   class Irfs;
+}
+
+namespace observationSim {
+
+class Spacecraft;
+
+/**
+ * @class ExposureSampler
+ *
+ * @brief Generate the detected events of a steady point source
+ * without simulating each incident photon.
+ *
+ * The simulation time is divided into bins.  For each bin, candidate
+ * events are drawn from a Poisson distribution whose mean is given by
+ * the source rate and an upper envelope of the effective area over
+ * the bin.  Each candidate is given an arrival time, energy and set
+ * of response functions, and is accepted with the ratio of the
+ * livetime fraction times the effective area at its arrival time and
+ * energy to the envelope.  The accepted events are thus distributed
+ * as for the photon-by-photon simulation, while the response
+ * functions are only evaluated for the candidates.  Only the PSF and
+ * energy dispersion are applied per event, by
+ * EventContainer::addDetectedEvent(...).
+ *
+ * The spectrum is represented by a sorted pool of energies drawn from
+ * the source, which is divided into quantiles of equal probability.
+ * The effective area is tabulated once, as a function of inclination
+ * and averaged over azimuth, at the edges and median of each
+ * quantile.  The envelope for a quantile is the largest tabulated
+ * value over those energies and over the inclinations of the source
+ * at the start, center and end of the bin, with a margin for the
+ * azimuthal dependence and the efficiency factor.
+ */
+
+class ExposureSampler : public EventFeed {
+
+public:
+
+   /// @param source The photon source.  It must be steady, with a
+   ///        fixed direction.  The sampler takes ownership.
+   /// @param name The source name as given in the source summaries.
+   /// @param id The ID number for events from this source.
+   /// @param srcDir The direction of the source.
+   /// @param tstart Start time of the first bin (MET s).
+   /// @param binSize Width of the time bins (s).
+   /// @param respPtrs The response functions.
+   /// @param spacecraft Provides the attitude and livetime.
+   ExposureSampler(EventSource * source, const std::string & name, int id,
+                   const astro::SkyDir & srcDir, double tstart,
+                   double binSize,
+                   const std::vector<irfInterface::Irfs *> & respPtrs,
+                   Spacecraft * spacecraft);
+
+   virtual ~ExposureSampler();
+
+   virtual bool nextTime(double tmax, double & time);
+
+   virtual bool addEvent(EventContainer & events);
+
+   virtual void flush(EventContainer & events);
+
+private:
+
+   EventSource * m_source;
+   std::string m_name;
+   int m_id;
+   astro::SkyDir m_srcDir;
+
+   double m_binStart;
+   double m_binSize;
+
+   std::vector<irfInterface::Irfs *> m_respPtrs;
+   Spacecraft * m_spacecraft;
+
+   bool m_applyEdisp;
+
+   /// Cross-sectional area (cm^2) with respect to which the source
+   /// rate is computed.
+   double m_area;
+
+   /// Sorted pool of energies drawn from the source spectrum.
+   std::vector<double> m_energies;
+
+   /// Effective area (cm^2) for each set of response functions at
+   /// the edges and medians of the energy quantiles, on a uniform
+   /// grid in cos(inclination).
+   std::vector<double> m_aeff;
+
+   /// Cumulative envelope of the effective area over response
+   /// functions and energy quantiles for the current bin.
+   std::vector<double> m_weights;
+
+   struct Detection {
+      Detection(double t, double e, size_t irf)
+         : time(t), energy(e), irfIndex(irf) {}
+      double time;
+      double energy;
+      size_t irfIndex;
+      bool operator<(const Detection & rhs) const {
+         return time < rhs.time;
+      }
+   };
+
+   /// Detected events that have not yet been passed to the
+   /// EventContainer, in time order.
+   std::deque<Detection> m_detections;
+
+   /// Number of incident photons not yet recorded.
+   unsigned long m_incident;
+
+   static size_t s_poolSize;
+   static size_t s_nquantiles;
+   static size_t s_ncostheta;
+   static size_t s_nphi;
+   static double s_envelopeMargin;
+
+   void fillEnergyPool(double time);
+
+   void fillAeffTable();
+
+   /// The energy of the pool at the given edge (even index) or
+   /// median (odd index) of the quantiles.
+   double nodeEnergy(size_t node) const;
+
+   /// Upper envelope of the effective area for the given response
+   /// functions and energy quantile over a range of cos(inclination).
+   double envelope(size_t irf, size_t quantile, double cosmin,
+                   double cosmax) const;
+
+   /// Draw an energy from the given quantile of the energy pool.
+   double drawEnergy(size_t quantile) const;
+
+   /// Draw the detected events for the next time bin.
+   void sampleBin();
+
+   ExposureSampler(const ExposureSampler &);
+   ExposureSampler & operator=(const ExposureSampler &);
+
+};
+
+} // namespace observationSim
+
+#endif // observationSim_ExposureSampler_h
@@ -0,0 +1,190 @@
+/**
+ * @file Ft1EventFeed.cxx
+ * @brief Implementation of the feed of events from an existing FT1
+ * file.
+ *
+ * $Header$
+ */
+
+#include <algorithm>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+#include "tip/IFileSvc.h"
+
+#include "astro/SkyDir.h"
+
+#include "observationSim/AsyncWriter.h"
+#include "observationSim/Event.h"
+#include "observationSim/EventContainer.h"
+#include "observationSim/Spacecraft.h"
+
+#include "ColumnWriter.h"
+#include "Ft1EventFeed.h"
+
+namespace {
+   const tip::Table * readTable(const std::string & file,
+                                const std::string & extension) {
+      std::lock_guard<std::recursive_mutex>
+         lock(observationSim::AsyncWriter::fitsMutex());
+      return tip::IFileSvc::instance().readTable(file, extension);
+   }
+} // anonymous namespace
+
+namespace observationSim {
+
+Ft1EventFeed::Ft1EventFeed(const std::string & ft1File,
+                           const std::string & evTable, double tstart,
+                           Spacecraft * spacecraft, const std::string & name)
+   : m_table(readTable(ft1File, evTable)),
+     m_row(m_table->begin()), m_tstart(tstart), m_spacecraft(spacecraft),
+     m_name(name), m_haveEventType(false), m_haveSrcId(false),
+     m_haveMcEnergy(false), m_bitEventClass(false), m_haveRow(false),
+     m_time(0), m_tlast(0) {
+   std::lock_guard<std::recursive_mutex> lock(AsyncWriter::fitsMutex());
+   const std::vector<std::string> & fields(m_table->getValidFields());
+   m_haveEventType = (std::count(fields.begin(), fields.end(),
+                                 "event_type") > 0);
+   m_haveSrcId = (std::count(fields.begin(), fields.end(), "mc_src_id") > 0);
+   m_haveMcEnergy = (std::count(fields.begin(), fields.end(),
+                                "mcenergy") > 0);
+// Pass 8 files store EVENT_CLASS as a bit array and earlier ones as
+// an integer.  Find which by reading the first row.
+   if (m_row != m_table->end()) {
+      try {
+         tip::BitStruct bits;
+         (*m_row)["EVENT_CLASS"].get(bits);
+         m_bitEventClass = true;
+      } catch (std::exception &) {
+         m_bitEventClass = false;
+      }
+   }
+}
+
+Ft1EventFeed::~Ft1EventFeed() {
+   std::lock_guard<std::recursive_mutex> lock(AsyncWriter::fitsMutex());
+   delete m_table;
+}
+
+bool Ft1EventFeed::nextTime(double tmax, double & time) {
+   std::lock_guard<std::recursive_mutex> lock(AsyncWriter::fitsMutex());
+   while (!m_haveRow) {
+      if (!(m_row != m_table->end())) {
+         return false;
+      }
+      (*m_row)["TIME"].get(m_time);
+      if (m_time < m_tlast) {
+         throw std::runtime_error("Ft1EventFeed: the events are not "
+                                  "in time order.");
+      }
+      m_tlast = m_time;
+      if (m_time >= m_tstart) {
+         m_haveRow = true;
+      } else {
+         ++m_row;
+      }
+   }
+   if (m_time >= tmax) {
+      return false;
+   }
+   time = m_time;
+   return true;
+}
+
+bool Ft1EventFeed::addEvent(EventContainer & events) {
+// The lock is not held while the event is added, since that may hand
+// a buffer to the writer.
+   Event event(readEvent());
+   events.addMergedEvent(event, sourceName(event.eventId()),
+                         event.eventId());
+   return true;
+}
+
+Event Ft1EventFeed::readEvent() {
+   std::lock_guard<std::recursive_mutex> lock(AsyncWriter::fitsMutex());
+   const tip::ConstTableRecord & row(*m_row);
+   double energy, ra, dec;
+   row["ENERGY"].get(energy);
+   row["RA"].get(ra);
+   row["DEC"].get(dec);
+   int convType;
+   row["CONVERSION_TYPE"].get(convType);
+   unsigned long eventType(1 << convType);
+   if (m_haveEventType) {
+      tip::BitStruct bits;
+      row["EVENT_TYPE"].get(bits);
+      eventType = bits;
+   }
+   int id(0);
+   if (m_haveSrcId) {
+      row["MC_SRC_ID"].get(id);
+   }
+   double trueEnergy(energy);
+   if (m_haveMcEnergy) {
+      row["MCENERGY"].get(trueEnergy);
+   }
+   unsigned long evtClass(eventClass(row));
+
+   m_haveRow = false;
+   ++m_row;
+
+   astro::SkyDir appDir(ra, dec);
+   double zenith_ra, zenith_dec;
+   m_spacecraft->getZenith(m_time, zenith_ra, zenith_dec);
+   Event event(m_time, energy, appDir, appDir, m_spacecraft->zAxis(m_time),
+               m_spacecraft->xAxis(m_time),
+               astro::SkyDir(zenith_ra, zenith_dec), convType, eventType,
+               trueEnergy, 0, 0, id);
+   event.setEventClass(evtClass);
+   return event;
+}
+
+unsigned long Ft1EventFeed::
+eventClass(const tip::ConstTableRecord & row) const {
+   if (m_bitEventClass) {
+      tip::BitStruct bits;
+      row["EVENT_CLASS"].get(bits);
+      return bits;
+   }
+   long value;
+   row["EVENT_CLASS"].get(value);
+   return value;
+}
+
+int Ft1EventFeed::maxSourceId(const std::string & ft1File,
+                              const std::string & evTable) {
+   std::lock_guard<std::recursive_mutex> lock(AsyncWriter::fitsMutex());
+   FitsHandle fits(ft1File, evTable, READONLY);
+   int colnum;
+   try {
+      colnum = columnNumber(fits.fptr(), "MC_SRC_ID");
+   } catch (std::runtime_error &) {
+      return -1;
+   }
+   long nrows(0);
+   int status(0);
+   fits_get_num_rows(fits.fptr(), &nrows, &status);
+   checkFitsStatus(status, "Cannot read " + ft1File);
+   const long blockSize(100000);
+   double maxId(-1);
+   std::vector<double> ids;
+   for (long first = 0; first < nrows; first += blockSize) {
+      readColumn(fits.fptr(), colnum, first,
+                 std::min(blockSize, nrows - first), ids);
+      maxId = std::max(maxId, *std::max_element(ids.begin(), ids.end()));
+   }
+   return static_cast<int>(maxId);
+}
+
+const std::string & Ft1EventFeed::sourceName(int id) {
+   std::map<int, std::string>::const_iterator item(m_names.find(id));
+   if (item == m_names.end()) {
+      std::ostringstream name;
+      name << m_name << "_" << id;
+      item = m_names.insert(std::make_pair(id, name.str())).first;
+   }
+   return item->second;
+}
+
+} // namespace observationSim
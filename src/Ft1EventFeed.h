@@ -0,0 +1,107 @@
+/**
+ * @file Ft1EventFeed.h
+ * @brief Event feed that reads the events of an existing FT1 file.
+ *
+ * $Header$
+ */
+
+#ifndef observationSim_Ft1EventFeed_h
+#define observationSim_Ft1EventFeed_h
+
+#include <map>
+#include <string>
+
+#include "tip/Table.h"
+
+#include "observationSim/EventFeed.h"
+
+namespace observationSim {
+
+class Event;
+class Spacecraft;
+
+/**
+ * @class Ft1EventFeed
+ *
+ * @brief Merge the events of an existing FT1 file, e.g., real data or
+ * a prior simulation of the background, with those of the simulated
+ * sources.
+ *
+ * The rows are read one at a time, so the memory used does not depend
+ * on the size of the file.  The rows must be in time order, and those
+ * outside of the simulation interval are skipped.  The measured
+ * quantities and the MC_SRC_ID and MCENERGY columns, if present, are
+ * copied, so the ID numbers of the simulated sources should not
+ * overlap the MC_SRC_ID values; see maxSourceId(...).  The
+ * spacecraft attitude and zenith, and hence THETA, PHI and
+ * ZENITH_ANGLE, are taken from the spacecraft data used for the
+ * simulation, which should be the FT2 file for the FT1 file.
+ */
+
+class Ft1EventFeed : public EventFeed {
+
+public:
+
+   /// @param ft1File The FT1 file.
+   /// @param evTable The name of the events extension.
+   /// @param tstart Start time of the simulation (MET s).
+   /// @param spacecraft Provides the spacecraft attitude and location.
+   /// @param name Prefix for the source names of the events, which
+   ///        are given by appending the MC_SRC_ID values.
+   Ft1EventFeed(const std::string & ft1File, const std::string & evTable,
+                double tstart, Spacecraft * spacecraft,
+                const std::string & name="background");
+
+   virtual ~Ft1EventFeed();
+
+   virtual bool nextTime(double tmax, double & time);
+
+   virtual bool addEvent(EventContainer & events);
+
+   /// The largest MC_SRC_ID value in the FT1 file, or -1 if it has no
+   /// rows or no MC_SRC_ID column.  The column is read in blocks, so
+   /// the memory used does not depend on the size of the file.
+   static int maxSourceId(const std::string & ft1File,
+                          const std::string & evTable);
+
+private:
+
+   const tip::Table * m_table;
+   tip::Table::ConstIterator m_row;
+   double m_tstart;
+   Spacecraft * m_spacecraft;
+   std::string m_name;
+
+   /// Which of the optional columns are present.
+   bool m_haveEventType;
+   bool m_haveSrcId;
+   bool m_haveMcEnergy;
+
+   /// True if EVENT_CLASS is a bit array (Pass 8 and later) rather
+   /// than an integer.
+   bool m_bitEventClass;
+
+   /// The time of the current row.
+   bool m_haveRow;
+   double m_time;
+   double m_tlast;
+
+   /// Source names, keyed by MC_SRC_ID.
+   std::map<int, std::string> m_names;
+
+   /// Read the event in the current row and advance to the next.
+   /// This holds AsyncWriter::fitsMutex().
+   Event readEvent();
+
+   unsigned long eventClass(const tip::ConstTableRecord & row) const;
+
+   const std::string & sourceName(int id);
+
+   Ft1EventFeed(const Ft1EventFeed &);
+   Ft1EventFeed & operator=(const Ft1EventFeed &);
+
+};
+
+} // namespace observationSim
+
+#endif // observationSim_Ft1EventFeed_h
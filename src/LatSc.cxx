@@ -9,31 +9,149 @@
 #include <algorithm>
 #include <iomanip>
 #include <sstream>
-
-#include "tip/IFileSvc.h"
-#include "tip/Table.h"
+#include <stdexcept>
 
 #include "astro/EarthCoordinate.h"
 #include "astro/PointingTransform.h"
 #include "astro/GPS.h"
 
+#include "observationSim/AsyncWriter.h"
+
+#include "ColumnWriter.h"
 #include "LatSc.h"
 
 namespace observationSim {
 
-LatSc::LatSc(const std::string & ft2file) : Spacecraft() {
-   const tip::Table * scData = 
-      tip::IFileSvc::instance().readTable(ft2file, "SC_DATA");
-   tip::Table::ConstIterator it(scData->begin());
-   tip::ConstTableRecord & row(*it);
-   for ( ; it != scData->end(); ++it) {
-      m_start.push_back(row["START"].get());
-      m_stop.push_back(row["STOP"].get());
-      double duration(m_stop.back() - m_start.back());
-      m_livetimefrac.push_back(row["livetime"].get()/duration);
+double LatSc::s_saaStep(1.);
+double LatSc::s_saaTolerance(1e-3);
+
+LatSc::LatSc(const std::string & ft2file, double tstart, double tstop,
+             double margin, long chunkSize) 
+   : Spacecraft(), m_scData(0), m_startCol(0), m_stopCol(0),
+     m_livetimeCol(0), m_nrows(0), m_chunkSize(std::max(chunkSize, 1L)),
+     m_constantAttitude(false),
+     m_attitudeStart(0), m_attitudeStop(0), m_firstRow(0), m_rowsRead(0),
+     m_peakRows(0) {
+   std::lock_guard<std::recursive_mutex> lock(AsyncWriter::fitsMutex());
+   m_scData = new FitsHandle(ft2file, "SC_DATA", READONLY);
+   try {
+      int status(0);
+      fits_get_num_rows(m_scData->fptr(), &m_nrows, &status);
+      checkFitsStatus(status, "LatSc: cannot read " + ft2file);
+      if (m_nrows == 0) {
+         throw std::runtime_error("LatSc: no rows found in " + ft2file);
+      }
+      m_startCol = columnNumber(m_scData->fptr(), "START");
+      m_stopCol = columnNumber(m_scData->fptr(), "STOP");
+      m_livetimeCol = columnNumber(m_scData->fptr(), "LIVETIME");
+   } catch (...) {
+      delete m_scData;
+      throw;
+   }
+   m_fileStart = cellValue(m_startCol, 0);
+   m_lastStart = cellValue(m_startCol, m_nrows - 1);
+   m_dt = (cellValue(m_stopCol, m_nrows - 1) - m_fileStart)/m_nrows;
+
+// Load only those rows that cover [tstart - margin, tstop + margin],
+// up to the maximum chunk size.
+   long first(std::max(rowIndex(tstart - margin), 0L));
+   long last(std::min(first + m_chunkSize, m_nrows));
+   if (tstop > tstart) {
+      last = std::min(last, rowIndex(tstop + margin) + 1);
+   }
+   loadRows(first, std::max(last, first + 1));
+
+// The attitude is checked over the whole simulation, not just the
+// first window.
+   long lastRow(m_nrows);
+   if (tstop > tstart) {
+      lastRow = std::min(lastRow, rowIndex(tstop + margin) + 1);
+   }
+   checkAttitude(first, std::max(lastRow, first + 1));
+}
+
+LatSc::~LatSc() {
+   std::lock_guard<std::recursive_mutex> lock(AsyncWriter::fitsMutex());
+   delete m_scData;
+}
+
+double LatSc::cellValue(int colnum, long irow) const {
+   std::vector<double> value;
+   readColumn(m_scData->fptr(), colnum, irow, 1, value);
+   return value[0];
+}
+
+long LatSc::rowIndex(double time) const {
+// The START column is sorted, so only O(log(nrows)) cells need to be
+// read from the file.
+   std::lock_guard<std::recursive_mutex> lock(AsyncWriter::fitsMutex());
+   long lo(0);
+   long hi(m_nrows);
+   while (lo < hi) {
+      long mid((lo + hi)/2);
+      if (cellValue(m_startCol, mid) <= time) {
+         lo = mid + 1;
+      } else {
+         hi = mid;
+      }
    }
-   m_dt = (m_stop.back() - m_start.front())/m_start.size();
-   delete scData;
+   return lo - 1;
+}
+
+void LatSc::loadWindow(double time) const {
+   long first(std::max(rowIndex(time), 0L));
+   loadRows(first, std::min(first + m_chunkSize, m_nrows));
+}
+
+void LatSc::loadRows(long first, long last) const {
+   std::lock_guard<std::recursive_mutex> lock(AsyncWriter::fitsMutex());
+// Each column of the window is read as a single block.
+   readColumn(m_scData->fptr(), m_startCol, first, last - first, m_start);
+   readColumn(m_scData->fptr(), m_stopCol, first, last - first, m_stop);
+   readColumn(m_scData->fptr(), m_livetimeCol, first, last - first,
+              m_livetimefrac);
+   for (size_t i = 0; i < m_livetimefrac.size(); i++) {
+      m_livetimefrac[i] /= m_stop[i] - m_start[i];
+   }
+   m_firstRow = first;
+   m_rowsRead += m_start.size();
+   m_peakRows = std::max(m_peakRows, m_start.size());
+}
+
+void LatSc::checkAttitude(long first, long last) {
+   const char * fields[] = {"RA_SCZ", "DEC_SCZ", "RA_SCX", "DEC_SCX"};
+   int columns[4];
+   double values[4];
+   std::lock_guard<std::recursive_mutex> lock(AsyncWriter::fitsMutex());
+   try {
+      for (size_t k = 0; k < 4; k++) {
+         columns[k] = columnNumber(m_scData->fptr(), fields[k]);
+         values[k] = cellValue(columns[k], first);
+      }
+   } catch (std::runtime_error &) {
+// Without the attitude columns, leave the attitude to astro::GPS.
+      return;
+   }
+// The rows are read a chunk at a time, one column block at a time.
+   std::vector<double> block;
+   for (long start = first; start < last; start += m_chunkSize) {
+      long nrows(std::min(m_chunkSize, last - start));
+      for (size_t k = 0; k < 4; k++) {
+         readColumn(m_scData->fptr(), columns[k], start, nrows, block);
+         if (std::count(block.begin(), block.end(), values[k])
+             != nrows) {
+            return;
+         }
+      }
+   }
+// astro::GPS interpolates the axes between rows, so identical rows
+// give this same rotation.
+   astro::PointingTransform transform(astro::SkyDir(values[0], values[1]),
+                                      astro::SkyDir(values[2], values[3]));
+   m_rotation = transform.localToCelestial();
+   m_attitudeStart = cellValue(m_startCol, first);
+   m_attitudeStop = cellValue(m_stopCol, last - 1);
+   m_constantAttitude = true;
 }
 
 astro::SkyDir LatSc::zAxis(double time) {
@@ -61,6 +179,10 @@ double LatSc::EarthLat(double time) {
 }
 
 CLHEP::HepRotation LatSc::InstrumentToCelestial(double time) {
+   if (m_constantAttitude && m_attitudeStart <= time 
+       && time <= m_attitudeStop) {
+      return m_rotation;
+   }
    astro::GPS * gps(astro::GPS::instance());
    gps->time(time);
    astro::PointingTransform transform(gps->zAxisDir(), gps->xAxisDir());
@@ -95,12 +217,15 @@ void LatSc::getZenith(double time, double & ra, double & dec) {
 }
 
 double LatSc::livetimeFrac(double time) const {
-   if (m_start.size() == 0) { // We are not using an FT2 file.
+   if (m_nrows == 0) { // We are not using an FT2 file.
       return Spacecraft::livetimeFrac(time);
    }
-   if (time < m_start.front() || time > m_start.back()) {
+   if (time < m_fileStart || time > m_lastStart) {
       return 0;
    }
+   if (time < m_start.front() || time > m_stop.back()) {
+      loadWindow(time);
+   }
    size_t indx = (std::upper_bound(m_start.begin(), m_start.end(), time)
                   - m_start.begin() - 1);
    if (m_start.at(indx) <= time && time <= m_stop.at(indx)) {
@@ -109,4 +234,57 @@ double LatSc::livetimeFrac(double time) const {
    return 0;
 }
 
+double LatSc::nextLiveTime(double time) {
+   if (m_nrows > 0) {
+// Outside of the FT2 file the livetime is zero, and the attitude
+// model cannot be evaluated.
+      if (time < m_fileStart || time > m_lastStart) {
+         return time;
+      }
+      if (livetimeFrac(time) <= 0) {
+         return nextLiveRow(time);
+      }
+   }
+   if (!inSaa(time)) {
+      return time;
+   }
+// Step through the SAA passage, then bisect the last step to find
+// its end to within s_saaTolerance.
+   double lo(time);
+   double hi(time + s_saaStep);
+   while (inSaa(hi)) {
+      lo = hi;
+      hi += s_saaStep;
+   }
+   while (hi - lo > s_saaTolerance) {
+      double mid((lo + hi)/2.);
+      if (inSaa(mid)) {
+         lo = mid;
+      } else {
+         hi = mid;
+      }
+   }
+   return hi;
+}
+
+double LatSc::nextLiveRow(double time) const {
+// Find the start of the next row with non-zero livetime, sliding the
+// window forward as needed.
+   size_t indx = (std::upper_bound(m_start.begin(), m_start.end(), time)
+                  - m_start.begin());
+   while (true) {
+      for ( ; indx < m_start.size(); indx++) {
+         if (m_livetimefrac.at(indx) > 0) {
+            return m_start.at(indx);
+         }
+      }
+      long next_row(m_firstRow + static_cast<long>(m_start.size()));
+      if (next_row >= m_nrows) {
+         return time;
+      }
+      loadRows(next_row, std::min(next_row + m_chunkSize, m_nrows));
+      indx = 0;
+   }
+}
+
 } // namespace observationSim
@@ -9,10 +9,17 @@
 #ifndef observationSim_LatSc_h
 #define observationSim_LatSc_h
 
+#include <string>
+#include <vector>
+
+#include "CLHEP/Vector/Rotation.h"
+
 #include "observationSim/Spacecraft.h"
 
 namespace observationSim {
 
+class FitsHandle;
+
 /**
  * @class LatSc
  *
@@ -28,10 +35,26 @@ class LatSc : public Spacecraft {
 
 public:
 
-   LatSc() : Spacecraft() {}
-   LatSc(const std::string & ft2file);
-
-   virtual ~LatSc() {}
+   LatSc() : Spacecraft(), m_scData(0), m_startCol(0), m_stopCol(0),
+             m_livetimeCol(0), m_nrows(0), m_chunkSize(0),
+             m_constantAttitude(false), m_attitudeStart(0),
+             m_attitudeStop(0), m_firstRow(0), m_rowsRead(0),
+             m_peakRows(0) {}
+
+   /// @param ft2file The pointing history (FT2) file.
+   /// @param tstart Start time of the simulation (MET s).
+   /// @param tstop Stop time of the simulation (MET s).  If this is
+   ///        not greater than tstart, only the first chunk of rows
+   ///        after tstart is loaded.
+   /// @param margin Padding (s) applied to either end of the
+   ///        [tstart, tstop] interval when selecting the rows to load.
+   /// @param chunkSize Maximum number of FT2 rows held in memory.
+   ///        As the simulation proceeds past the loaded rows, the
+   ///        window slides forward by reading the next chunk.
+   LatSc(const std::string & ft2file, double tstart=0, double tstop=0,
+         double margin=600., long chunkSize=100000);
+
+   virtual ~LatSc();
 
    virtual astro::SkyDir zAxis(double time);
    virtual astro::SkyDir xAxis(double time);
@@ -49,12 +72,94 @@ public:
 
    virtual double livetimeFrac(double time) const;
 
+   /// Skips zero-livetime FT2 rows and SAA passages.
+   virtual double nextLiveTime(double time);
+
+   virtual bool tracksDeadIntervals() const {
+      return true;
+   }
+
+   /// The total number of FT2 rows read from the pointing history file.
+   unsigned long rowsRead() const {return m_rowsRead;}
+
+   /// The largest number of bytes held in the window of START, STOP
+   /// and LIVETIME values.  This does not include the attitude and
+   /// orbit, which astro::GPS reads from the whole pointing history.
+   size_t peakWindowSize() const {
+      return m_peakRows*3*sizeof(double);
+   }
+
 private:
 
+   /// The FT2 table, kept open so that the row window can be reloaded.
+   FitsHandle * m_scData;
+
+   /// The numbers of the START, STOP and LIVETIME columns, looked up
+   /// once.
+   int m_startCol;
+   int m_stopCol;
+   int m_livetimeCol;
+
+   /// Number of rows in the FT2 table.
+   long m_nrows;
+
+   /// Maximum number of rows to hold in memory.
+   long m_chunkSize;
+
+   /// START times of the first and last rows of the FT2 file.
+   double m_fileStart;
+   double m_lastStart;
+
    double m_dt;
-   std::vector<double> m_start;
-   std::vector<double> m_stop;
-   std::vector<double> m_livetimefrac;
+
+   /// The fixed instrument-to-celestial rotation and the interval of
+   /// FT2 rows over which it applies.  If the rows spanning the
+   /// simulation all have the same axes, as for a pointed or
+   /// calibration observation, InstrumentToCelestial(...) returns
+   /// this rotation instead of evaluating astro::GPS for each photon.
+   bool m_constantAttitude;
+   double m_attitudeStart;
+   double m_attitudeStop;
+   CLHEP::HepRotation m_rotation;
+
+   /// Step size (s) used to find the end of an SAA passage, and the
+   /// precision (s) to which it is found.
+   static double s_saaStep;
+   static double s_saaTolerance;
+
+   /// The currently loaded window of rows.  These are mutable since
+   /// the window is moved from within livetimeFrac(...) const.
+   mutable long m_firstRow;
+   mutable std::vector<double> m_start;
+   mutable std::vector<double> m_stop;
+   mutable std::vector<double> m_livetimefrac;
+
+   mutable unsigned long m_rowsRead;
+   mutable size_t m_peakRows;
+
+   /// Return the value of the column for the given row.
+   double cellValue(int colnum, long irow) const;
+
+   /// Binary search for the last row with START <= time.
+   long rowIndex(double time) const;
+
+   /// Load up to m_chunkSize rows, beginning with the row containing
+   /// the given time.
+   void loadWindow(double time) const;
+
+   /// Load the rows in the range [first, last).
+   void loadRows(long first, long last) const;
+
+   /// The START of the first row after time with non-zero livetime,
+   /// or time if there is none.
+   double nextLiveRow(double time) const;
+
+   /// Set the constant attitude if the instrument axes of the rows in
+   /// the range [first, last) are all the same.
+   void checkAttitude(long first, long last);
+
+   LatSc(const LatSc &) : Spacecraft() {}
+   LatSc & operator=(const LatSc &) {return *this;}
 
 };
 
@@ -0,0 +1,95 @@
+/**
+ * @file MemoryBudget.cxx
+ * @brief Implementation of the output buffer memory budget.
+ *
+ * $Header$
+ */
+
+#ifndef WIN32
+#include <sys/resource.h>
+#endif
+
+#include <algorithm>
+
+#include "observationSim/ContainerBase.h"
+#include "observationSim/MemoryBudget.h"
+
+namespace observationSim {
+
+void MemoryBudget::addContainer(ContainerBase * container) {
+   if (std::find(m_containers.begin(), m_containers.end(), container)
+       == m_containers.end()) {
+      m_containers.push_back(container);
+   }
+}
+
+void MemoryBudget::removeContainer(ContainerBase * container) {
+   m_containers.erase(std::remove(m_containers.begin(), m_containers.end(),
+                                  container), m_containers.end());
+}
+
+void MemoryBudget::check() {
+   while (true) {
+      size_t total(0);
+      ContainerBase * largest(0);
+      for (size_t i = 0; i < m_containers.size(); i++) {
+         size_t nbytes(m_containers[i]->bufferedBytes());
+         total += nbytes;
+         if (m_containers[i]->canFlush() &&
+             (largest == 0 || nbytes > largest->bufferedBytes())) {
+            largest = m_containers[i];
+         }
+      }
+      std::unique_lock<std::mutex> lock(m_writingMutex);
+      size_t writing(m_writingBytes);
+      total += writing;
+      if (total > m_peakBytes) {
+         m_peakBytes = total;
+      }
+      if (m_maxBytes == 0 || total <= m_maxBytes) {
+         return;
+      }
+      if (largest != 0) {
+// Flushing may hand the buffer to the writer, so the lock must not
+// be held.
+         lock.unlock();
+         largest->flush();
+      } else if (writing > 0) {
+         m_writingReleased.wait(lock, [this, writing]() {
+               return m_writingBytes < writing;
+            });
+      } else {
+         return;
+      }
+   }
+}
+
+void MemoryBudget::addWriting(size_t nbytes) {
+   std::lock_guard<std::mutex> lock(m_writingMutex);
+   m_writingBytes += nbytes;
+}
+
+void MemoryBudget::releaseWriting(size_t nbytes) {
+   {
+      std::lock_guard<std::mutex> lock(m_writingMutex);
+      m_writingBytes -= nbytes;
+   }
+   m_writingReleased.notify_all();
+}
+
+size_t MemoryBudget::peakRss() {
+#ifndef WIN32
+   struct rusage usage;
+   if (getrusage(RUSAGE_SELF, &usage) == 0) {
+#ifdef __APPLE__
+      return static_cast<size_t>(usage.ru_maxrss);
+#else
+// Linux reports kilobytes.
+      return static_cast<size_t>(usage.ru_maxrss)*1024;
+#endif
+   }
+#endif
+   return 0;
+}
+
+} // namespace observationSim
@@ -6,21 +6,30 @@
  * $Header: /nfs/slac/g/glast/ground/cvs/ScienceTools-scons/observationSim/src/ScDataContainer.cxx,v 1.45 2011/04/12 05:47:43 jchiang Exp $
  */
 
+#include <cmath>
 #include <cstdlib>
+
+#include <algorithm>
+#include <functional>
 #include <sstream>
 #include <stdexcept>
 
-#include "st_facilities/FitsUtil.h"
 #include "st_facilities/Util.h"
 
 #include "astro/EarthCoordinate.h"
 
+#include "tip/IFileSvc.h"
+#include "tip/Table.h"
+
 #include "fitsGen/Ft2File.h"
 
 #include "flux/EventSource.h"
 
+#include "observationSim/AsyncWriter.h"
 #include "observationSim/EventContainer.h"
+#include "observationSim/MemoryBudget.h"
 #include "observationSim/ScDataContainer.h"
+#include "ColumnWriter.h"
 
 namespace {
    double geomag_lat(const std::vector<double> & scPosition,
@@ -35,9 +44,23 @@ namespace {
 namespace observationSim {
 
 ScDataContainer::~ScDataContainer() {
-   if (m_scData.size() > 0) {
+// The writes use the data members, so they must be finished even if
+// the file cannot be completed.
+   try {
+      close();
+   } catch (...) {
+      try {
+         waitForWrites();
+      } catch (...) {
+      }
+   }
+}
+
+void ScDataContainer::close() {
+   if (m_scData.size() > 0 || m_output) {
       writeScData();
    }
+   waitForWrites();
 }
 
 void ScDataContainer::init() {
@@ -67,76 +90,306 @@ void ScDataContainer::addScData(double time, Spacecraft * spacecraft,
       spacecraft->getZenith(time, raZenith, decZenith);
       double livetimeFrac = spacecraft->livetimeFrac(time);
 
-      m_scData.push_back(ScData(time, zAxis.ra(), zAxis.dec(), 
-                                spacecraft->EarthLon(time), 
-                                spacecraft->EarthLat(time),
-                                zAxis, xAxis, spacecraft->inSaa(time),
-                                scPosition, raZenith, decZenith,
-                                livetimeFrac));
+      double lon(spacecraft->EarthLon(time));
+      double lat(spacecraft->EarthLat(time));
+      bool inSaa(spacecraft->inSaa(time));
+
+      m_scData.time.push_back(time);
+      m_scData.raScz.push_back(zAxis.ra());
+      m_scData.decScz.push_back(zAxis.dec());
+      m_scData.raScx.push_back(xAxis.ra());
+      m_scData.decScx.push_back(xAxis.dec());
+      m_scData.lon.push_back(lon);
+      m_scData.lat.push_back(lat);
+      m_scData.position.insert(m_scData.position.end(), 
+                               scPosition.begin(), scPosition.begin() + 3);
+      m_scData.raZenith.push_back(raZenith);
+      m_scData.decZenith.push_back(decZenith);
+      m_scData.livetimeFrac.push_back(livetimeFrac);
+      m_scData.inSaa.push_back(inSaa);
+      m_simTime = time;
    } catch (std::exception & eObj) {
       if (!st_facilities::Util::expectedException(eObj,"Time out of Range!")) {
          throw;
       }
    }
-   if (flush || m_scData.size() >= m_maxNumEntries) {
+   if (flush || fileRows() >= m_maxNumEntries) {
       writeScData();
+   } else if (m_chunkRows > 0 && m_scData.size() > m_chunkRows) {
+      appendRows(false);
+   }
+   checkMemoryBudget();
+}
+
+void ScDataContainer::addScData(double tstart, double tstop, 
+                                double interval, Spacecraft * spacecraft) {
+   if (interval <= 0) {
+      throw std::invalid_argument("ScDataContainer::addScData: "
+                                  "interval must be positive.");
+   }
+   long nrows(static_cast<long>(std::ceil((tstop - tstart)/interval)));
+   unsigned long maxrows(m_maxNumEntries);
+   if (m_chunkRows > 0) {
+      maxrows = std::min(maxrows, static_cast<unsigned long>(m_chunkRows + 1));
+   }
+   if (m_budget && m_budget->maxBytes() > 0) {
+      maxrows = std::min(maxrows, static_cast<unsigned long>(
+                            m_budget->maxBytes()/ScBuffer::rowBytes() + 1));
+   }
+   m_scData.reserve(std::min(static_cast<unsigned long>(std::max(nrows, 0L)),
+                             maxrows));
+   for (long i = 0; i < nrows; i++) {
+      addScData(tstart + i*interval, spacecraft);
    }
 }
 
 void ScDataContainer::writeScData() {
-   if (m_writeData) {
-      std::string ft2File = outputFileName();
-      long npts(m_scData.size());
-
-      fitsGen::Ft2File ft2(ft2File, npts, m_tablename);
-
-      double start_time = m_scData.begin()->time();
-      double stop_time = 2.*m_scData[npts-1].time() - m_scData[npts-2].time();
-      ft2.setObsTimes(start_time, stop_time);
-
-      std::vector<ScData>::const_iterator sc = m_scData.begin();
-      for ( ; ft2.itor() != ft2.end() && sc != m_scData.end();
-            ft2.next(), ++sc) {
-         ft2["start"].set(sc->time());
-         double interval;
-         if (sc+1 != m_scData.end()) {
-            ft2["stop"].set((sc+1)->time());
-            interval = (sc+1)->time() - sc->time();
-         } else {
-            ft2["stop"].set(stop_time);
-            interval = stop_time - sc->time();
-         }
-         ft2["livetime"].set(sc->livetimeFrac()*interval);
-         ft2["lat_geo"].set(sc->lat());
-         ft2["lon_geo"].set(sc->lon());
-         double met((ft2["start"].get() + ft2["stop"].get())/2.);
-         ft2["geomag_lat"].set(::geomag_lat(sc->position(), met));
-         ft2.setScAxes(sc->zAxis().ra(), sc->zAxis().dec(),
-                       sc->xAxis().ra(), sc->xAxis().dec());
-         ft2["sc_position"].set(sc->position());
-         ft2["ra_zenith"].set(sc->raZenith());
-         ft2["dec_zenith"].set(sc->decZenith());
-         ft2["in_saa"].set(sc->inSaa());
-         if (sc->inSaa()) {
-            ft2["livetime"].set(0);
-         }
-         ft2["data_qual"].set(1);
-         ft2["lat_config"].set(1);
+   if (m_writeData && (m_scData.size() > 0 || m_output)) {
+      double stop_time(appendRows(true));
+      submitWrite(std::bind(&ScDataContainer::closeFile, this, m_output,
+                            stop_time));
+      m_output.reset();
+      m_outputRows = 0;
+      m_fileNum++;
+   }
+
+   m_scData.clear();
+}
+
+double ScDataContainer::appendRows(bool endOfFile) {
+   if (!m_writeData) {
+      m_scData.clear();
+      return 0;
+   }
+   size_t npts(m_scData.size());
+   if (!endOfFile && npts > 0) {
+      npts--;
+   }
+   if (npts == 0) {
+      return m_prevTime;
+   }
+   if (!m_output) {
+      m_output.reset(new Ft2Output());
+      m_output->fileName = outputFileName();
+      m_output->creatorName = creator();
+      m_output->startTime = m_scData.time.front();
+      submitWrite(std::bind(&ScDataContainer::createFile, this, m_output));
+   }
+
+// Hand the rows to the writer, keeping the last one if needed.
+   std::shared_ptr<ScBuffer> buffer(new ScBuffer());
+   buffer->swap(m_scData);
+   if (m_chunkRows > 0) {
+      m_scData.reserve(m_chunkRows + 1);
+   }
+   if (npts < buffer->size()) {
+      m_scData.appendRow(*buffer, npts);
+      buffer->resize(npts);
+   }
+
+// The STOP of the last row of the file is extrapolated from the
+// previous interval.  The geomagnetic latitudes are computed here
+// since astro's field model is not thread-safe.
+   buffer->stop.resize(npts);
+   buffer->geomagLat.resize(npts);
+   for (size_t i = 0; i < npts; i++) {
+      double & stop(buffer->stop[i]);
+      if (i + 1 < npts) {
+         stop = buffer->time[i+1];
+      } else if (m_scData.size() > 0) {
+         stop = m_scData.time.front();
+      } else if (i > 0) {
+         stop = 2.*buffer->time[i] - buffer->time[i-1];
+      } else if (m_outputRows > 0) {
+         stop = 2.*buffer->time[i] - m_prevTime;
+      } else {
+         stop = buffer->time[i];
       }
-      ft2.setPhduKeyword("FILENAME", ft2File);
-      ft2.setPhduKeyword("VERSION", 1);
-      ft2.setPhduKeyword("CREATOR", creator());
+      std::vector<double> position(buffer->position.begin() + 3*i,
+                                   buffer->position.begin() + 3*i + 3);
+      buffer->geomagLat[i] = ::geomag_lat(position,
+                                          (buffer->time[i] + stop)/2.);
+   }
+   m_prevTime = buffer->time.back();
+   m_outputRows += npts;
+   submitWrite(std::bind(&ScDataContainer::writeRows, this, m_output,
+                         buffer), npts*ScBuffer::rowBytes());
+   return buffer->stop.back();
+}
 
-      writeParFileParams(ft2.header());
+void ScDataContainer::
+createFile(const std::shared_ptr<Ft2Output> & output) const {
+   const std::string & ft2File(output->fileName);
+   fitsGen::Ft2File ft2(ft2File, 0, m_tablename);
+   ft2.setPhduKeyword("FILENAME", finalFileName(ft2File));
+   ft2.setPhduKeyword("VERSION", 1);
+   ft2.setPhduKeyword("CREATOR", output->creatorName);
 
-      ft2.close();
+   writeParFileParams(ft2.header());
 
-      st_facilities::FitsUtil::writeChecksums(ft2File);
+   ft2.close();
 
-      m_fileNum++;
+   output->table = tip::IFileSvc::instance().editTable(ft2File, m_tablename);
+   output->fits.reset(new FitsHandle(ft2File, m_tablename));
+}
+
+void ScDataContainer::
+writeRows(const std::shared_ptr<Ft2Output> & output,
+          const std::shared_ptr<ScBuffer> & buffer) const {
+   tip::Table * table(output->openTable());
+   tip::Index_t first(output->nrows);
+   long npts(buffer->size());
+   output->nrows += npts;
+   table->setNumRecords(output->nrows);
+
+   std::vector<double> livetime(npts);
+   for (long i = 0; i < npts; i++) {
+      livetime[i] = buffer->inSaa[i] ? 0 : buffer->livetimeFrac[i]
+         *(buffer->stop[i] - buffer->time[i]);
    }
+   std::vector<int> flags(npts, 1);
 
-   m_scData.clear();
+// The rows are added through tip, so that its record count stays
+// current, and each column is then written with a single cfitsio
+// call.
+   fitsfile * fptr(output->fits->fptr());
+   writeColumn(fptr, "START", buffer->time, first);
+   writeColumn(fptr, "STOP", buffer->stop, first);
+   writeColumn(fptr, "LIVETIME", livetime, first);
+   writeColumn(fptr, "LAT_GEO", buffer->lat, first);
+   writeColumn(fptr, "LON_GEO", buffer->lon, first);
+   writeColumn(fptr, "GEOMAG_LAT", buffer->geomagLat, first);
+   writeColumn(fptr, "RA_SCZ", buffer->raScz, first);
+   writeColumn(fptr, "DEC_SCZ", buffer->decScz, first);
+   writeColumn(fptr, "RA_SCX", buffer->raScx, first);
+   writeColumn(fptr, "DEC_SCX", buffer->decScx, first);
+   writeColumn(fptr, "SC_POSITION", buffer->position, first);
+   writeColumn(fptr, "RA_ZENITH", buffer->raZenith, first);
+   writeColumn(fptr, "DEC_ZENITH", buffer->decZenith, first);
+   writeColumn(fptr, "IN_SAA", buffer->inSaa, first);
+   writeColumn(fptr, "DATA_QUAL", flags, first);
+   writeColumn(fptr, "LAT_CONFIG", flags, first);
+}
+
+void ScDataContainer::
+closeFile(const std::shared_ptr<Ft2Output> & output, double stop_time) const {
+   const std::string & ft2File(output->fileName);
+   tip::Table * table(output->openTable());
+
+   writeDateKeywords(table, output->startTime, stop_time);
+   writeMemoryKeywords(table->getHeader());
+   delete output->table;
+   output->table = 0;
+
+// The rest is written through the cfitsio handle, which has kept the
+// file open, with the checksums last.
+   FitsHandle & fits(*output->fits);
+   writePhduDateKeywords(fits, output->startTime, stop_time);
+   writeChecksums(fits.fptr());
+   fits.close();
+   output->fits.reset();
+
+   compressFile(ft2File);
+}
+
+tip::Table * ScDataContainer::Ft2Output::openTable() const {
+   if (table == 0) {
+      throw std::runtime_error("ScDataContainer: " + fileName
+                               + " is not open for writing.");
+   }
+   return table;
+}
+
+ScDataContainer::Ft2Output::Ft2Output()
+   : startTime(0), table(0), nrows(0) {}
+
+ScDataContainer::Ft2Output::~Ft2Output() {
+// The last reference may be dropped in either thread.
+   std::lock_guard<std::recursive_mutex> lock(AsyncWriter::fitsMutex());
+   fits.reset();
+   delete table;
+}
+
+void ScDataContainer::ScBuffer::reserve(size_t n) {
+   time.reserve(n);
+   raScz.reserve(n);
+   decScz.reserve(n);
+   raScx.reserve(n);
+   decScx.reserve(n);
+   lon.reserve(n);
+   lat.reserve(n);
+   position.reserve(3*n);
+   raZenith.reserve(n);
+   decZenith.reserve(n);
+   livetimeFrac.reserve(n);
+   inSaa.reserve(n);
+}
+
+void ScDataContainer::ScBuffer::clear() {
+   time.clear();
+   raScz.clear();
+   decScz.clear();
+   raScx.clear();
+   decScx.clear();
+   lon.clear();
+   lat.clear();
+   position.clear();
+   raZenith.clear();
+   decZenith.clear();
+   livetimeFrac.clear();
+   inSaa.clear();
+   stop.clear();
+   geomagLat.clear();
+}
+
+void ScDataContainer::ScBuffer::swap(ScBuffer & other) {
+   time.swap(other.time);
+   raScz.swap(other.raScz);
+   decScz.swap(other.decScz);
+   raScx.swap(other.raScx);
+   decScx.swap(other.decScx);
+   lon.swap(other.lon);
+   lat.swap(other.lat);
+   position.swap(other.position);
+   raZenith.swap(other.raZenith);
+   decZenith.swap(other.decZenith);
+   livetimeFrac.swap(other.livetimeFrac);
+   inSaa.swap(other.inSaa);
+   stop.swap(other.stop);
+   geomagLat.swap(other.geomagLat);
+}
+
+void ScDataContainer::ScBuffer::appendRow(const ScBuffer & other, size_t i) {
+   time.push_back(other.time[i]);
+   raScz.push_back(other.raScz[i]);
+   decScz.push_back(other.decScz[i]);
+   raScx.push_back(other.raScx[i]);
+   decScx.push_back(other.decScx[i]);
+   lon.push_back(other.lon[i]);
+   lat.push_back(other.lat[i]);
+   position.insert(position.end(), other.position.begin() + 3*i,
+                   other.position.begin() + 3*i + 3);
+   raZenith.push_back(other.raZenith[i]);
+   decZenith.push_back(other.decZenith[i]);
+   livetimeFrac.push_back(other.livetimeFrac[i]);
+   inSaa.push_back(other.inSaa[i]);
+}
+
+void ScDataContainer::ScBuffer::resize(size_t n) {
+   time.resize(n);
+   raScz.resize(n);
+   decScz.resize(n);
+   raScx.resize(n);
+   decScx.resize(n);
+   lon.resize(n);
+   lat.resize(n);
+   position.resize(3*n);
+   raZenith.resize(n);
+   decZenith.resize(n);
+   livetimeFrac.resize(n);
+   inSaa.resize(n);
+   stop.resize(n);
+   geomagLat.resize(n);
 }
 
 } // namespace observationSim
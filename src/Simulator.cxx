@@ -7,20 +7,28 @@
  * $Header: /nfs/slac/g/glast/ground/cvs/ScienceTools-scons/observationSim/src/Simulator.cxx,v 1.64 2013/06/28 20:48:20 jperkins Exp $
  */
 
+#include <cmath>
+
 #include <algorithm>
 #include <fstream>
 #include <iostream>
+#include <limits>
+#include <list>
+#include <set>
 #include <sstream>
+#include <stdexcept>
 #include <string>
 
 #include "facilities/Util.h"
+#include "facilities/commonUtilities.h"
 
 #include "st_facilities/Util.h"
 
+#include "CLHEP/Random/JamesRandom.h"
+
 #include "astro/PointingHistory.h"
 
 #include "flux/EventSource.h"
-#include "flux/CompositeSource.h"
 #include "flux/SpectrumFactoryTable.h"
 #include "flux/FluxMgr.h"
 #include "flux/ISpectrumFactory.h"
@@ -30,9 +38,39 @@
 #include "flux/SpectrumFactory.h"
 
 #include "observationSim/EventContainer.h"
+#include "observationSim/EventFeed.h"
 #include "observationSim/ScDataContainer.h"
 #include "observationSim/Simulator.h"
+#include "EventCache.h"
+#include "ExposureSampler.h"
 #include "LatSc.h"
+#include "SourceModelCache.h"
+#include "SourceScheduler.h"
+
+namespace {
+/// Return true if all of the photons drawn from the source have the
+/// same direction, i.e., if it is a point source, and set dir to that
+/// direction.
+   bool pointSourceDir(EventSource * source, double time,
+                       const CLHEP::HepRotation & rotMatrix,
+                       astro::SkyDir & dir) {
+      int ntrials(3);
+      for (int i = 0; i < ntrials; i++) {
+         EventSource * event(source->event(time));
+         if (event == 0 || !event->enabled()) {
+            return false;
+         }
+         astro::SkyDir trialDir(rotMatrix(-event->launchDir()),
+                                astro::SkyDir::EQUATORIAL);
+         if (i == 0) {
+            dir = trialDir;
+         } else if (trialDir.difference(dir) > 1e-6) {
+            return false;
+         }
+      }
+      return true;
+   }
+} // anonymous namespace
 
 namespace observationSim {
 
@@ -49,6 +87,12 @@ std::vector<astro::GPS::RockType> Simulator::s_rockTypes(rockTypes,
 Simulator::~Simulator() {
    delete m_fluxMgr;
    delete m_source;
+   for (size_t i = 0; i < m_feeds.size(); i++) {
+      delete m_feeds[i];
+   }
+   for (size_t i = 0; i < m_cacheWriters.size(); i++) {
+      delete m_cacheWriters[i];
+   }
 }
 
 void Simulator::init(const std::string &sourceName,
@@ -62,11 +106,9 @@ void Simulator::init(const std::string &sourceName,
         maxSimTime, pointingHistoryOffset);
 }
 
-void Simulator::init(const std::vector<std::string> &sourceNames,
-                     const std::vector<std::string> &fileList,
-                     double totalArea, double startTime, 
-                     std::string pointingHistory, double maxSimTime,
-                     double pointingHistoryOffset) {
+void Simulator::initFluxMgr(const std::vector<std::string> &fileList,
+                            double startTime, std::string pointingHistory,
+                            double maxSimTime, double pointingHistoryOffset) {
    m_absTime = startTime;
    m_numEvents = 0;
    m_newEvent = 0;
@@ -74,6 +116,9 @@ void Simulator::init(const std::vector<std::string> &sourceNames,
 
    m_maxSimTime = maxSimTime;
 
+   m_scInterval = 30.;
+   m_nextScTime = startTime;
+
 // Create the FluxMgr object, providing access to the sources in the
 // various xml files.
    try {
@@ -86,6 +131,7 @@ void Simulator::init(const std::vector<std::string> &sourceNames,
       throw std::runtime_error(message.str());
    }      
    m_fluxMgr->setExpansion(1.);    // is this already the default?
+   m_xmlFiles = fileList;
 
 // Set the start of the simulation time in GPS:
    astro::GPS::instance()->time(m_absTime);
@@ -101,12 +147,20 @@ void Simulator::init(const std::vector<std::string> &sourceNames,
                              << "Using default rocking strategy." 
                              << std::endl;
          setRocking();
-         pointingHistory = "none";
       }
    } else {
 // Use the default rocking strategy.
       setRocking();
    }
+}
+
+void Simulator::init(const std::vector<std::string> &sourceNames,
+                     const std::vector<std::string> &fileList,
+                     double totalArea, double startTime, 
+                     std::string pointingHistory, double maxSimTime,
+                     double pointingHistoryOffset) {
+   initFluxMgr(fileList, startTime, pointingHistory, maxSimTime,
+               pointingHistoryOffset);
 
 // Set the LAT sphere cross-sectional area.
    try {
@@ -120,14 +174,16 @@ void Simulator::init(const std::vector<std::string> &sourceNames,
                           << std::endl;
    }
 
-// Create a new pointer to the desired source from m_fluxMgr.
-   m_source = new CompositeSource();
+// Add the desired sources by name.  The scheduler has m_fluxMgr
+// create each one when it is first needed.
+   m_source = new SourceScheduler();
+   std::list<std::string> available(m_fluxMgr->sourceList());
+   std::set<std::string> known(available.begin(), available.end());
    int nsrcs(0);
    for (std::vector<std::string>::const_iterator name = sourceNames.begin();
         name != sourceNames.end(); name++) {
-      EventSource * source;
-      if ( (source = m_fluxMgr->source(*name)) ) {
-         m_source->addSource(source);
+      if (known.count(*name)) {
+         m_source->addSource(*name, m_fluxMgr);
          nsrcs++;
          m_formatter->info() << "added source \"" << *name 
                              << "\"" << std::endl;
@@ -144,29 +200,51 @@ void Simulator::init(const std::vector<std::string> &sourceNames,
                          << std::endl;
       std::exit(1);
    }
+}
+
+void Simulator::setIdOffset(int id) {
+   m_fluxMgr->setIdOffset(id);
+   if (m_source) {
+      m_source->setIdOffset(id);
+   }
+}
 
-   if (pointingHistory == "none" || pointingHistory == "") {
-// Add a "timetick30s" source to the m_source object.
-      EventSource *clock;
-      try {
-         clock = m_fluxMgr->source("obsSim_timetick30s");
-      } catch(...) {
-         m_formatter->err() << "Simulator::Simulator: \n"
-                            << "Failed to create a obsSim_timetick30s source." 
-                            << std::endl;
-         listSources();
-         std::exit(1);
+void Simulator::pruneSources(const astro::SkyDir & center, double radius) {
+   LatSc spacecraft;
+   CLHEP::HepRotation rotMatrix(spacecraft.InstrumentToCelestial(m_absTime));
+// Take the directions from the source definitions where possible, so
+// that the sources do not have to be created.
+   std::vector<std::string> names;
+   for (size_t i = 0; i < m_source->size(); i++) {
+      names.push_back(m_source->name(i));
+   }
+   std::map<std::string, astro::SkyDir> directions;
+   SourceModelCache::sourceDirections(m_xmlFiles, names, directions);
+   size_t npoint(0);
+   for (size_t i = 0; i < m_source->size(); i++) {
+      if (!m_source->active(i)) {
+         continue;
+      }
+      astro::SkyDir srcDir;
+      std::map<std::string, astro::SkyDir>::const_iterator
+         dir(directions.find(m_source->name(i)));
+      if (dir != directions.end()) {
+         srcDir = dir->second;
+      } else if (!pointSourceDir(m_source->source(i), m_absTime, rotMatrix,
+                                 srcDir)) {
+         continue;
       }
-      try {
-         m_source->addSource(clock);
-      } catch(...) {
-         m_formatter->err() << "Failed to add a timetick30s source to the "
-                            << "CompositeSource object."
-                            << std::endl;
-         listSources();
-         std::exit(1);
+      npoint++;
+      if (srcDir.difference(center)*180./M_PI > radius) {
+         m_prunedSources.push_back(std::make_pair(m_source->name(i),
+                                                  m_source->id(i)));
+         m_source->removeSource(i);
       }
    }
+   m_formatter->info() << "Pruned " << m_prunedSources.size() << " of "
+                       << npoint << " point sources lying more than "
+                       << radius << " degrees from the acceptance cone "
+                       << "center." << std::endl;
 }
 
 void Simulator::listSources() const {
@@ -196,6 +274,25 @@ void Simulator::makeEvents(EventContainer &events,
                            bool useSimTime) {
    m_useSimTime = useSimTime;
    m_elapsedTime = 0.;
+   if (useSimTime) {
+      m_source->setHorizon(m_absTime + m_simTime);
+   } else {
+      m_source->setHorizon(std::numeric_limits<double>::max());
+   }
+
+   if (!m_exposureSrcNames.empty()) {
+      createExposureSamplers(respPtrs, spacecraft);
+      m_exposureSrcNames.clear();
+   }
+   if (!m_eventCacheKeys.empty()) {
+      if (useSimTime) {
+         openEventCaches();
+      } else {
+         m_formatter->info() << "Event caches require a simulation time "
+                             << "and will not be used." << std::endl;
+      }
+      m_eventCacheKeys.clear();
+   }
 
 // Loop over event generation steps until done.
    while (!done()) {
@@ -208,9 +305,15 @@ void Simulator::makeEvents(EventContainer &events,
 // time beyond the end time of that file.
          try {
             m_newEvent = m_source->event(m_absTime);
-            if (!m_newEvent->enabled()) { 
+            if (m_newEvent == 0) { 
 // There are no more events from any sources (allegedly), so we
-// exit the loop.
+// exit the loop, after advancing to the end of the observation window
+// so that the spacecraft data cover it and the event feeds and
+// caches are completed.
+               if (m_useSimTime) {
+                  advanceClock(m_simTime - m_elapsedTime, scData, 
+                               spacecraft);
+               }
                break;
             }
             m_newEvent->code(m_source->numSource());
@@ -227,16 +330,37 @@ void Simulator::makeEvents(EventContainer &events,
 // event arrives within the present observing window given by
 // m_simTime.
       if ( !m_useSimTime ||  (m_elapsedTime+m_interval < m_simTime) ) {
-         m_absTime += m_interval;
-         m_elapsedTime += m_interval;
-         m_fluxMgr->pass(m_interval);
+         advanceClock(m_interval, scData, spacecraft);
+         drainFeeds(m_absTime, events);
+
+// The dead intervals (zero livetime or SAA passage) are found once
+// per photon.  A photon arriving in one cannot be accepted, so it is
+// discarded and the clock jumps to the end of the interval.  Only the
+// sources with arrivals inside the interval draw them again, from its
+// end; for memoryless arrivals this leaves the accepted events
+// statistically unchanged.
+         double live_time(spacecraft->nextLiveTime(m_absTime));
+         if (live_time > m_absTime) {
+            m_newEvent = 0;
+            advanceClock(live_time - m_absTime, scData, spacecraft);
+            m_source->reset(m_absTime);
+            continue;
+         }
+         bool live(spacecraft->tracksDeadIntervals());
          
-         if (!m_usePointingHistory && 
-             m_newEvent->particleName() == "TimeTick") {
-            scData.addScData(m_newEvent, spacecraft);
-         } else {
-            if (events.addEvent(m_newEvent, respPtrs, spacecraft)) {
-               m_numEvents++;
+         EventCacheWriter * writer(cacheWriter());
+         if (writer) {
+            writer->addName(m_newEvent->name());
+         }
+// Spacecraft data are generated on their own time grid, so any
+// "TimeTick" sources are ignored.
+         if (m_newEvent->particleName() != "TimeTick" &&
+             events.addEvent(m_newEvent, respPtrs, spacecraft, false,
+                             live)) {
+            m_numEvents++;
+            if (writer) {
+               writer->addEvent(events.lastEvent(), 
+                                m_newEvent->name());
             }
          }
 // EventSource::event(...) does not generate a pointer to a new object
@@ -245,11 +369,179 @@ void Simulator::makeEvents(EventContainer &events,
       } else if (m_useSimTime) {
 // No more events to process for this observation window, so advance
 // to the end of the window, updating all of the time accumulators.
-         m_absTime += (m_simTime - m_elapsedTime);
-         m_fluxMgr->pass(m_simTime - m_elapsedTime);
-         m_elapsedTime = m_simTime;
+         advanceClock(m_simTime - m_elapsedTime, scData, spacecraft);
       }
    } // while (!done())
+   drainFeeds(m_absTime, events);
+   for (size_t i = 0; i < m_feeds.size(); i++) {
+      m_feeds[i]->flush(events);
+   }
+   closeEventCaches(events, !m_useSimTime || m_elapsedTime >= m_simTime);
+}
+
+void Simulator::openEventCaches() {
+   size_t ncached(0);
+   size_t nsimulated(0);
+   m_cacheWriters.resize(m_source->size(), 0);
+   for (size_t i = 0; i < m_source->size(); i++) {
+      std::map<std::string, std::string>::const_iterator
+         key(m_eventCacheKeys.find(m_source->name(i)));
+      if (!m_source->active(i) || key == m_eventCacheKeys.end()) {
+         continue;
+      }
+      std::string filename(facilities::commonUtilities::joinPath(
+                              m_eventCacheDir, "events_" + key->second 
+                              + ".dat"));
+      if (st_facilities::Util::fileExists(filename)) {
+         try {
+            CachedEventFeed * feed(new CachedEventFeed(filename));
+            std::vector<int> ids;
+            for (size_t j = 0; j < feed->names().size(); j++) {
+               ids.push_back(m_source->sourceId(i, feed->names()[j]));
+            }
+            feed->setIds(ids);
+            m_feeds.push_back(feed);
+            m_source->removeSource(i);
+            ncached++;
+            continue;
+         } catch (std::runtime_error & eObj) {
+            m_formatter->info() << eObj.what() << std::endl;
+         }
+      }
+// Seed the source's own engine from its key, so that the events of
+// each source are independent of those cached for the others.
+      unsigned long long hash(0);
+      std::istringstream(key->second) >> std::hex >> hash;
+      long seed(static_cast<long>(hash % 900000000ULL));
+      m_source->setEngine(i, new CLHEP::HepJamesRandom(seed));
+      m_cacheWriters[i] = new EventCacheWriter(filename);
+      nsimulated++;
+   }
+   m_formatter->info() << "Using cached events for " << ncached 
+                       << " sources; simulating and caching " 
+                       << nsimulated << " sources." << std::endl;
+}
+
+void Simulator::closeEventCaches(EventContainer & events, bool complete) {
+   if (m_cacheWriters.empty()) {
+      return;
+   }
+   for (size_t i = 0; i < m_cacheWriters.size(); i++) {
+      if (m_cacheWriters[i] && complete) {
+         try {
+            m_cacheWriters[i]->close(events.eventIds());
+         } catch (std::runtime_error & eObj) {
+            m_formatter->info() << eObj.what() << std::endl;
+         }
+      }
+      delete m_cacheWriters[i];
+   }
+   m_cacheWriters.clear();
+   m_source->useDefaultEngine();
+}
+
+EventCacheWriter * Simulator::cacheWriter() const {
+   long indx(m_source->currentSource());
+   if (indx < 0 || static_cast<size_t>(indx) >= m_cacheWriters.size()) {
+      return 0;
+   }
+   return m_cacheWriters[indx];
+}
+
+void Simulator::
+createExposureSamplers(std::vector<irfInterface::Irfs *> & respPtrs,
+                       Spacecraft * spacecraft) {
+   if (respPtrs.empty()) {
+      m_formatter->info() << "Exposure-based sampling requires response "
+                          << "functions.  All sources will be simulated "
+                          << "photon by photon." << std::endl;
+      return;
+   }
+   CLHEP::HepRotation rotMatrix(spacecraft->InstrumentToCelestial(m_absTime));
+   for (size_t i = 0; i < m_source->size(); i++) {
+      if (!m_source->active(i) ||
+          std::find(m_exposureSrcNames.begin(), m_exposureSrcNames.end(),
+                    m_source->name(i)) == m_exposureSrcNames.end()) {
+         continue;
+      }
+      astro::SkyDir srcDir;
+      if (!pointSourceDir(m_source->source(i), m_absTime, rotMatrix, 
+                          srcDir)) {
+         m_formatter->info() << m_source->name(i) << " is not a point "
+                             << "source and will be simulated photon "
+                             << "by photon." << std::endl;
+         continue;
+      }
+      EventSource * source(m_source->releaseSource(i));
+      m_feeds.push_back(new ExposureSampler(source, m_source->name(i),
+                                            m_source->id(i), srcDir,
+                                            m_absTime, m_scInterval,
+                                            respPtrs, spacecraft));
+      m_formatter->info() << "Sampling events for " << m_source->name(i)
+                          << " from its exposure." << std::endl;
+   }
+}
+
+void Simulator::drainFeeds(double time, EventContainer & events) {
+   while (m_useSimTime || m_numEvents < m_maxNumEvents) {
+// Find the feed with the earliest event before time.
+      EventFeed * next(0);
+      double tnext(time);
+      for (size_t i = 0; i < m_feeds.size(); i++) {
+         double feedTime;
+         if (m_feeds[i]->nextTime(tnext, feedTime)) {
+            next = m_feeds[i];
+            tnext = feedTime;
+         }
+      }
+      if (next == 0) {
+         return;
+      }
+      if (next->addEvent(events)) {
+         m_numEvents++;
+      }
+   }
+}
+
+void Simulator::advanceClock(double dt, ScDataContainer & scData,
+                             Spacecraft * spacecraft) {
+   if (m_useSimTime && m_elapsedTime + dt > m_simTime) {
+      dt = m_simTime - m_elapsedTime;
+   }
+   m_absTime += dt;
+   m_elapsedTime += dt;
+   m_fluxMgr->pass(dt);
+   fillScData(m_absTime, scData, spacecraft);
+}
+
+void Simulator::fillScData(double time, ScDataContainer & scData,
+                           Spacecraft * spacecraft) {
+   if (m_usePointingHistory) {
+      return;
+   }
+   for ( ; m_nextScTime < time; m_nextScTime += m_scInterval) {
+      scData.addScData(m_nextScTime, spacecraft);
+   }
+}
+
+void Simulator::setScDataInterval(double interval) {
+   if (interval <= 0) {
+      throw std::invalid_argument("Simulator::setScDataInterval: "
+                                  "interval must be positive.");
+   }
+   m_scInterval = interval;
+}
+
+void Simulator::generateScData(double simulationTime, 
+                               ScDataContainer &scData,
+                               Spacecraft *spacecraft) {
+   m_simTime = std::min(simulationTime, m_maxSimTime);
+   scData.addScData(m_nextScTime, m_absTime + m_simTime, m_scInterval,
+                    spacecraft);
+   m_absTime += m_simTime;
+   while (m_nextScTime < m_absTime) {
+      m_nextScTime += m_scInterval;
+   }
 }
 
 bool Simulator::done() {
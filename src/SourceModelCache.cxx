@@ -0,0 +1,329 @@
+/**
+ * @file SourceModelCache.cxx
+ * @brief Implementation of the reduced source model cache.
+ *
+ * $Header$
+ */
+
+#include <cctype>
+#include <cstdio>
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+
+#include "facilities/commonUtilities.h"
+
+#include "st_facilities/Util.h"
+
+#include "astro/SkyDir.h"
+
+#include "SourceModelCache.h"
+#include "TempFileName.h"
+
+namespace {
+/// A top-level source element of a source library.
+   struct SourceElement {
+      std::string name;
+      std::string text;
+      std::vector<std::string> refs;
+   };
+
+   std::string readFile(const std::string & filename) {
+      std::ifstream file(filename.c_str(), std::ios::in | std::ios::binary);
+      if (!file) {
+         throw std::runtime_error("Cannot read " + filename);
+      }
+      std::ostringstream contents;
+      contents << file.rdbuf();
+      return contents.str();
+   }
+
+/// 64-bit FNV-1a hash, accumulated over successive calls.
+   void fnvHash(const std::string & data, unsigned long long & hash) {
+      for (size_t i = 0; i < data.size(); i++) {
+         hash ^= static_cast<unsigned char>(data[i]);
+         hash *= 1099511628211ULL;
+      }
+   }
+
+/// The value of an attribute in a start tag, or an empty string.
+   std::string attribute(const std::string & tag, const std::string & name) {
+      size_t pos(0);
+      while ((pos = tag.find(name, pos)) != std::string::npos) {
+         size_t eq(tag.find_first_not_of(" \t\r\n", pos + name.size()));
+         bool atStart(pos > 0 && std::isspace(tag[pos - 1]));
+         pos += name.size();
+         if (!atStart || eq == std::string::npos || tag[eq] != '=') {
+            continue;
+         }
+         size_t quote(tag.find_first_not_of(" \t\r\n", eq + 1));
+         if (quote == std::string::npos ||
+             (tag[quote] != '"' && tag[quote] != '\'')) {
+            continue;
+         }
+         size_t end(tag.find(tag[quote], quote + 1));
+         if (end == std::string::npos) {
+            break;
+         }
+         return tag.substr(quote + 1, end - quote - 1);
+      }
+      return "";
+   }
+
+   std::string elementName(const std::string & tag) {
+      size_t start(tag[1] == '/' ? 2 : 1);
+      size_t end(tag.find_first_of(" \t\r\n/>", start));
+      return tag.substr(start, end - start);
+   }
+
+/// Append the top-level source elements in the xml text to elements.
+/// This is a minimal scanner for the flux source library format,
+/// which does not use entities or CDATA sections.
+   void readSources(const std::string & filename, const std::string & text,
+                    std::vector<SourceElement> & elements) {
+      size_t pos(0);
+      int depth(0);
+      bool inSource(false);
+      size_t start(0);
+      while ((pos = text.find('<', pos)) != std::string::npos) {
+         size_t end;
+         if (text.compare(pos, 4, "<!--") == 0) {
+            end = text.find("-->", pos);
+            if (end == std::string::npos) {
+               break;
+            }
+            pos = end + 3;
+            continue;
+         }
+         if (text.compare(pos, 2, "<?") == 0 ||
+             text.compare(pos, 2, "<!") == 0) {
+            end = text.find('>', pos);
+            if (end == std::string::npos) {
+               break;
+            }
+            pos = end + 1;
+            continue;
+         }
+// Find the end of the tag, allowing for '>' in attribute values.
+         char quote(0);
+         for (end = pos + 1; end < text.size(); end++) {
+            if (quote) {
+               if (text[end] == quote) {
+                  quote = 0;
+               }
+            } else if (text[end] == '"' || text[end] == '\'') {
+               quote = text[end];
+            } else if (text[end] == '>') {
+               break;
+            }
+         }
+         if (end == text.size()) {
+            break;
+         }
+         std::string tag(text.substr(pos, end - pos + 1));
+         if (tag[1] == '/') {
+            depth--;
+            if (depth == 1 && inSource) {
+               elements.back().text = text.substr(start, end + 1 - start);
+               inSource = false;
+            }
+         } else {
+            bool selfClosing(tag[tag.size() - 2] == '/');
+            std::string name(elementName(tag));
+            if (depth == 1 && name == "source") {
+               elements.push_back(SourceElement());
+               elements.back().name = attribute(tag, "name");
+               start = pos;
+               inSource = true;
+               if (selfClosing) {
+                  elements.back().text = tag;
+                  inSource = false;
+               }
+            } else if (inSource && name == "nestedSource") {
+               elements.back().refs.push_back(attribute(tag, "sourceRef"));
+            }
+            if (!selfClosing) {
+               depth++;
+            }
+         }
+         pos = end + 1;
+      }
+      if (depth != 0 || inSource) {
+         throw std::runtime_error("Cannot parse the source library "
+                                  + filename);
+      }
+   }
+
+/// Add the sources referenced by nestedSource elements of the wanted
+/// sources until no more are found.
+   void addReferences(const std::vector<SourceElement> & elements,
+                      std::set<std::string> & wanted) {
+      bool added(true);
+      while (added) {
+         added = false;
+         for (size_t i = 0; i < elements.size(); i++) {
+            if (wanted.count(elements[i].name) == 0) {
+               continue;
+            }
+            for (size_t j = 0; j < elements[i].refs.size(); j++) {
+               added = wanted.insert(elements[i].refs[j]).second || added;
+            }
+         }
+      }
+   }
+
+/// Set dir to the fixed direction given by the source element, if it
+/// has exactly one celestial_dir or galactic_dir element and its
+/// photons are not spread over a solid angle or drawn by a Spectrum
+/// class, which may place them elsewhere.
+   bool fixedDirection(const SourceElement & element, astro::SkyDir & dir) {
+      const std::string & text(element.text);
+      if (!element.refs.empty() ||
+          text.find("<solid_angle") != std::string::npos ||
+          text.find("<SpectrumClass") != std::string::npos) {
+         return false;
+      }
+      size_t celestial(text.find("<celestial_dir"));
+      size_t galactic(text.find("<galactic_dir"));
+      size_t pos(std::min(celestial, galactic));
+      if (pos == std::string::npos ||
+          text.find("<celestial_dir", celestial + 1) != std::string::npos ||
+          text.find("<galactic_dir", galactic + 1) != std::string::npos ||
+          (celestial != std::string::npos && 
+           galactic != std::string::npos)) {
+         return false;
+      }
+      std::string tag(text.substr(pos, text.find('>', pos) - pos + 1));
+      bool isGalactic(pos == galactic);
+      std::string lon(attribute(tag, isGalactic ? "l" : "ra"));
+      std::string lat(attribute(tag, isGalactic ? "b" : "dec"));
+      double x, y;
+      if (!(std::istringstream(lon) >> x) || 
+          !(std::istringstream(lat) >> y)) {
+         return false;
+      }
+      dir = astro::SkyDir(x, y, isGalactic ? astro::SkyDir::GALACTIC
+                          : astro::SkyDir::EQUATORIAL);
+      return true;
+   }
+
+   std::string hexDigest(unsigned long long hash) {
+      std::ostringstream digest;
+      digest << std::hex << std::setw(16) << std::setfill('0') << hash;
+      return digest.str();
+   }
+} // anonymous namespace
+
+namespace observationSim {
+
+std::string SourceModelCache::
+modelFile(const std::vector<std::string> & xmlFiles,
+          const std::vector<std::string> & srcNames) {
+   std::vector<std::string> contents;
+   unsigned long long hash(14695981039346656037ULL);
+   fnvHash("SourceModelCache v1\n", hash);
+   for (size_t i = 0; i < xmlFiles.size(); i++) {
+      contents.push_back(readFile(xmlFiles[i]));
+      fnvHash(xmlFiles[i] + "\n", hash);
+      fnvHash(contents.back(), hash);
+   }
+   std::set<std::string> wanted(srcNames.begin(), srcNames.end());
+   for (std::set<std::string>::const_iterator name = wanted.begin();
+        name != wanted.end(); ++name) {
+      fnvHash("\n" + *name, hash);
+   }
+   std::string filename(facilities::commonUtilities::joinPath(
+                           m_cacheDir, "srcmodel_" + hexDigest(hash) 
+                           + ".xml"));
+   m_hit = st_facilities::Util::fileExists(filename);
+   if (m_hit) {
+      return filename;
+   }
+
+   std::vector<SourceElement> elements;
+   for (size_t i = 0; i < xmlFiles.size(); i++) {
+      readSources(xmlFiles[i], contents[i], elements);
+   }
+
+   addReferences(elements, wanted);
+
+// Write to a temporary file of this process and rename it, so that a
+// concurrent run never sees or writes to a partial file.
+   std::string tmpfile(tempFileName(filename));
+   std::ofstream output(tmpfile.c_str());
+   if (!output) {
+      throw std::runtime_error("Cannot write to the source model cache "
+                               "directory " + m_cacheDir);
+   }
+   output << "<source_library title=\"cached source model\">\n";
+   for (size_t i = 0; i < elements.size(); i++) {
+      if (wanted.count(elements[i].name)) {
+         output << elements[i].text << "\n";
+      }
+   }
+   output << "</source_library>\n";
+   output.close();
+   if (!output || std::rename(tmpfile.c_str(), filename.c_str()) != 0) {
+      std::remove(tmpfile.c_str());
+      throw std::runtime_error("Cannot write " + filename);
+   }
+   return filename;
+}
+
+void SourceModelCache::
+sourceDefinitions(const std::vector<std::string> & xmlFiles,
+                  const std::vector<std::string> & srcNames,
+                  std::map<std::string, std::string> & definitions) {
+   std::vector<SourceElement> elements;
+   for (size_t i = 0; i < xmlFiles.size(); i++) {
+      readSources(xmlFiles[i], readFile(xmlFiles[i]), elements);
+   }
+   definitions.clear();
+   for (size_t i = 0; i < srcNames.size(); i++) {
+      std::set<std::string> wanted;
+      wanted.insert(srcNames[i]);
+      addReferences(elements, wanted);
+      std::string text;
+      bool found(false);
+      for (size_t j = 0; j < elements.size(); j++) {
+         if (wanted.count(elements[j].name)) {
+            text += elements[j].text + "\n";
+            found = found || elements[j].name == srcNames[i];
+         }
+      }
+      if (found) {
+         definitions[srcNames[i]] = text;
+      }
+   }
+}
+
+void SourceModelCache::
+sourceDirections(const std::vector<std::string> & xmlFiles,
+                 const std::vector<std::string> & srcNames,
+                 std::map<std::string, astro::SkyDir> & directions) {
+   std::vector<SourceElement> elements;
+   for (size_t i = 0; i < xmlFiles.size(); i++) {
+      readSources(xmlFiles[i], readFile(xmlFiles[i]), elements);
+   }
+   std::set<std::string> wanted(srcNames.begin(), srcNames.end());
+   directions.clear();
+   for (size_t i = 0; i < elements.size(); i++) {
+      astro::SkyDir dir;
+      if (wanted.count(elements[i].name) &&
+          fixedDirection(elements[i], dir)) {
+         directions[elements[i].name] = dir;
+      }
+   }
+}
+
+std::string SourceModelCache::hashKey(const std::string & data) {
+   unsigned long long hash(14695981039346656037ULL);
+   fnvHash(data, hash);
+   return hexDigest(hash);
+}
+
+} // namespace observationSim
@@ -0,0 +1,86 @@
+/**
+ * @file SourceModelCache.h
+ * @brief Cache of source model xml files reduced to the sources that
+ * are actually simulated.
+ *
+ * $Header$
+ */
+
+#ifndef observationSim_SourceModelCache_h
+#define observationSim_SourceModelCache_h
+
+#include <map>
+#include <string>
+#include <vector>
+
+namespace astro {
+   class SkyDir;
+}
+
+namespace observationSim {
+
+/**
+ * @class SourceModelCache
+ *
+ * @brief Provide an xml file containing only the source definitions
+ * needed for a simulation, so that FluxMgr does not have to parse the
+ * full source libraries.
+ *
+ * The reduced file contains the top-level source elements of the
+ * input libraries that match the requested names, along with any
+ * sources they reference via nestedSource elements.  It is stored in
+ * the cache directory under a name derived from a hash of the
+ * contents of the input files and of the requested names, so later
+ * runs with the same inputs reuse it, and any change to the inputs
+ * results in a new file.  FluxMgr only reads xml, so the cached file
+ * is itself an xml source library.
+ */
+
+class SourceModelCache {
+
+public:
+
+   /// @param cacheDir Existing directory in which to keep the files.
+   SourceModelCache(const std::string & cacheDir) : m_cacheDir(cacheDir),
+                                                    m_hit(false) {}
+
+   /// Return the name of the reduced xml file for the given source
+   /// libraries and source names, creating it if necessary.
+   std::string modelFile(const std::vector<std::string> & xmlFiles,
+                         const std::vector<std::string> & srcNames);
+
+   /// True if the most recent call to modelFile(...) found an
+   /// existing file.
+   bool hit() const {
+      return m_hit;
+   }
+
+   /// The xml text defining each of the named sources, followed by
+   /// that of any sources it references, keyed by source name.  Names
+   /// that are not found are omitted.
+   static void 
+   sourceDefinitions(const std::vector<std::string> & xmlFiles,
+                     const std::vector<std::string> & srcNames,
+                     std::map<std::string, std::string> & definitions);
+
+   /// The directions of those named sources that are fixed points on
+   /// the sky according to their definitions, keyed by source name.
+   /// This does not require the sources to be created.
+   static void 
+   sourceDirections(const std::vector<std::string> & xmlFiles,
+                    const std::vector<std::string> & srcNames,
+                    std::map<std::string, astro::SkyDir> & directions);
+
+   /// A 64-bit FNV-1a hash of the data, as 16 hexadecimal digits.
+   static std::string hashKey(const std::string & data);
+
+private:
+
+   std::string m_cacheDir;
+   bool m_hit;
+
+};
+
+} // namespace observationSim
+
+#endif // observationSim_SourceModelCache_h
@@ -0,0 +1,254 @@
+/**
+ * @file SourceScheduler.cxx
+ * @brief Implementation of the priority-queue source scheduler.
+ *
+ * $Header$
+ */
+
+#include <stdexcept>
+
+#include "CLHEP/Random/Random.h"
+
+#include "flux/EventSource.h"
+#include "flux/FluxMgr.h"
+
+#include "observationSim/AsyncWriter.h"
+
+#include "SourceScheduler.h"
+
+namespace observationSim {
+
+SourceScheduler::~SourceScheduler() {
+   for (size_t i = 0; i < m_sources.size(); i++) {
+      delete m_sources[i];
+   }
+   useDefaultEngine();
+   for (size_t i = 0; i < m_engines.size(); i++) {
+      delete m_engines[i];
+   }
+}
+
+void SourceScheduler::addSource(EventSource * source) {
+   m_sources.push_back(source);
+   m_photons.push_back(0);
+   m_names.push_back(source->name());
+   m_byName.push_back(false);
+   m_active.push_back(true);
+   if (!m_engines.empty()) {
+      m_engines.push_back(0);
+   }
+   m_started = false;
+}
+
+void SourceScheduler::addSource(const std::string & name,
+                                FluxMgr * fluxMgr) {
+   m_fluxMgr = fluxMgr;
+   m_sources.push_back(0);
+   m_photons.push_back(0);
+   m_names.push_back(name);
+   m_byName.push_back(true);
+   m_active.push_back(true);
+   if (!m_engines.empty()) {
+      m_engines.push_back(0);
+   }
+   m_started = false;
+}
+
+void SourceScheduler::removeSource(size_t indx) {
+   delete m_sources.at(indx);
+   m_sources[indx] = 0;
+   m_photons[indx] = 0;
+   m_active[indx] = false;
+   m_started = false;
+}
+
+EventSource * SourceScheduler::releaseSource(size_t indx) {
+   EventSource * src(source(indx));
+   m_sources[indx] = 0;
+   m_photons[indx] = 0;
+   m_active[indx] = false;
+   m_started = false;
+   return src;
+}
+
+EventSource * SourceScheduler::source(size_t indx) {
+   if (m_sources.at(indx) == 0 && m_active[indx]) {
+// The source may draw random numbers when it is created, so use its
+// own engine.  Sources such as map cubes read FITS files when they
+// are created, which may happen while the writer is running.
+      selectEngine(indx);
+      std::lock_guard<std::recursive_mutex> lock(AsyncWriter::fitsMutex());
+      m_sources[indx] = m_fluxMgr->source(m_names[indx]);
+      if (m_sources[indx] == 0) {
+         throw std::runtime_error("SourceScheduler: FluxMgr failed to "
+                                  "create source " + m_names[indx]);
+      }
+   }
+   return m_sources[indx];
+}
+
+EventSource * SourceScheduler::event(double time) {
+   if (!m_started) {
+      reset(time);
+   }
+// The previous photon has been processed, so its source can now draw
+// its next arrival.
+   if (m_pending >= 0) {
+      schedule(m_pending, m_pendingTime);
+      m_pending = -1;
+   }
+   while (!m_queue.empty()) {
+      Arrival_t next(m_queue.top());
+      m_queue.pop();
+      size_t indx(next.second);
+// The photon was generated with its arrival, so the source's engine
+// is made current only for processing it.
+      selectEngine(indx);
+      EventSource * evt(m_photons[indx]);
+      if (evt == 0) {
+// The source was deleted because its arrival lies beyond the horizon,
+// so this photon will not be accepted and any photon from the source
+// will do.
+         EventSource * src(source(indx));
+         if (src == 0) {
+            continue;
+         }
+         evt = src->event(time);
+         if (evt == 0 || !evt->enabled()) {
+            release(indx, true);
+            continue;
+         }
+      }
+      m_photons[indx] = 0;
+      m_recent = evt;
+      m_arrival = next.first;
+      m_code = sourceId(next.second, evt->name());
+      m_pending = next.second;
+      m_pendingTime = next.first;
+      return m_recent;
+   }
+   m_recent = 0;
+   return 0;
+}
+
+void SourceScheduler::reset(double time) {
+   if (!m_started) {
+      for ( ; !m_queue.empty(); m_queue.pop()) {
+      }
+      m_pending = -1;
+      for (size_t i = 0; i < m_sources.size(); i++) {
+         m_photons[i] = 0;
+         if (m_active[i]) {
+            schedule(i, time);
+         }
+      }
+      m_started = true;
+      return;
+   }
+// The source of the most recent photon draws its next arrival as it
+// would have in event(...).
+   if (m_pending >= 0) {
+      schedule(m_pending, m_pendingTime);
+      m_pending = -1;
+   }
+// Arrivals inside the skipped interval are drawn again from its end.
+// The others are left alone.
+   std::vector<size_t> skipped;
+   for ( ; !m_queue.empty() && m_queue.top().first < time; m_queue.pop()) {
+      skipped.push_back(m_queue.top().second);
+   }
+   for (size_t i = 0; i < skipped.size(); i++) {
+      schedule(skipped[i], time);
+   }
+}
+
+void SourceScheduler::schedule(size_t indx, double time) {
+   EventSource * src(source(indx));
+   if (src == 0) {
+      return;
+   }
+   selectEngine(indx);
+// As with CompositeSource, the source generates the photon for its
+// next arrival along with the interval to it.
+   EventSource * evt(src->event(time));
+   m_photons[indx] = 0;
+   if (evt == 0 || !evt->enabled()) {
+// This source will not provide any more events.
+      release(indx, true);
+      return;
+   }
+   double dt(src->interval(time));
+   if (dt < 0) {
+      release(indx, true);
+      return;
+   }
+   m_photons[indx] = evt;
+   m_queue.push(Arrival_t(time + dt, indx));
+   if (time + dt >= m_horizon) {
+      release(indx);
+   }
+}
+
+void SourceScheduler::release(size_t indx, bool finished) {
+   if (m_byName[indx] || finished) {
+      delete m_sources[indx];
+      m_sources[indx] = 0;
+      m_photons[indx] = 0;
+   }
+   if (finished) {
+      m_active[indx] = false;
+   }
+}
+
+size_t SourceScheduler::residentSources() const {
+   size_t nsrcs(0);
+   for (size_t i = 0; i < m_sources.size(); i++) {
+      if (m_sources[i]) {
+         nsrcs++;
+      }
+   }
+   return nsrcs;
+}
+
+int SourceScheduler::sourceId(size_t indx, const std::string & name) {
+   if (name == m_names[indx]) {
+      return id(indx);
+   }
+   std::map<std::string, int>::const_iterator id(m_nestedIds.find(name));
+   if (id != m_nestedIds.end()) {
+      return id->second;
+   }
+   int idnum(m_idOffset + static_cast<int>(m_sources.size() 
+                                           + m_nestedIds.size()));
+   m_nestedIds[name] = idnum;
+   return idnum;
+}
+
+void SourceScheduler::setEngine(size_t indx, 
+                                CLHEP::HepRandomEngine * engine) {
+   if (m_engines.empty()) {
+      m_defaultEngine = CLHEP::HepRandom::getTheEngine();
+      m_engines.resize(m_sources.size(), 0);
+   }
+   delete m_engines.at(indx);
+   m_engines[indx] = engine;
+}
+
+void SourceScheduler::useDefaultEngine() {
+   if (m_defaultEngine) {
+      CLHEP::HepRandom::setTheEngine(m_defaultEngine);
+   }
+}
+
+void SourceScheduler::selectEngine(size_t indx) {
+   if (m_engines.empty()) {
+      return;
+   }
+   CLHEP::HepRandomEngine * engine(m_engines[indx] ? m_engines[indx]
+                                   : m_defaultEngine);
+   if (engine != CLHEP::HepRandom::getTheEngine()) {
+      CLHEP::HepRandom::setTheEngine(engine);
+   }
+}
+
+} // namespace observationSim
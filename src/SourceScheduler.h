@@ -0,0 +1,243 @@
+/**
+ * @file SourceScheduler.h
+ * @brief Priority queue of next arrival times for the photon sources.
+ *
+ * $Header$
+ */
+
+#ifndef observationSim_SourceScheduler_h
+#define observationSim_SourceScheduler_h
+
+#include <functional>
+#include <limits>
+#include <map>
+#include <queue>
+#include <string>
+#include <utility>
+#include <vector>
+
+class EventSource;
+class FluxMgr;
+
+namespace CLHEP {
+   class HepRandomEngine;
+}
+
+namespace observationSim {
+
+/**
+ * @class SourceScheduler
+ *
+ * @brief Replacement for flux's CompositeSource that keeps the next
+ * arrival time of each source in a priority queue.
+ *
+ * CompositeSource::event(...) asks every member source for a new
+ * interval on each call, so the cost per photon grows linearly with
+ * the number of sources.  Here, only the source providing the current
+ * photon has its next arrival drawn, so the cost per photon is
+ * O(log N).  Sources that are inactive have their next arrival far in
+ * the future and are not touched until then.  The photon returned for
+ * an arrival is the one the source generated when that arrival was
+ * drawn, so its properties and time belong to the arrival, and each
+ * photon costs a single draw.
+ *
+ * The interface follows that of CompositeSource, as used by
+ * Simulator: event(time) returns the next photon, interval(time) the
+ * time from the given time to its arrival, and numSource() the ID
+ * number of the source providing it.
+ *
+ * Sources may be added by name, in which case they are only created,
+ * by FluxMgr, when their first arrival is drawn.  Only a source can
+ * draw its own arrivals, so every source is created once, by the first
+ * reset(...).  A source created in this way is deleted again once it
+ * will provide no more events, or if its next arrival lies beyond the
+ * horizon, i.e., the end of the simulation, so that only the sources
+ * contributing photons are kept in memory.  A deleted source is
+ * recreated if its arrival time is reached or falls in an interval
+ * skipped by reset(...).  Sources that return no event or a disabled
+ * one have finished and are not recreated.
+ */
+
+class SourceScheduler {
+
+public:
+
+   SourceScheduler() : m_fluxMgr(0),
+                       m_horizon(std::numeric_limits<double>::max()),
+                       m_started(false), m_pending(-1), m_pendingTime(0),
+                       m_recent(0), m_arrival(0), m_code(0),
+                       m_idOffset(0), m_defaultEngine(0) {}
+
+   ~SourceScheduler();
+
+   /// Add a source.  The scheduler takes ownership of the pointer.
+   void addSource(EventSource * source);
+
+   /// Add the named source, to be created by fluxMgr when it is
+   /// needed.
+   void addSource(const std::string & name, FluxMgr * fluxMgr);
+
+   /// Delete the indx-th source.  The ID numbers of the other sources
+   /// are unchanged.  This must be done before the first call to
+   /// event(...).
+   void removeSource(size_t indx);
+
+   /// Remove the indx-th source, passing ownership of it to the
+   /// caller.  As for removeSource(...), this must be done before the
+   /// first call to event(...).
+   EventSource * releaseSource(size_t indx);
+
+   /// The indx-th source, created if necessary, or 0 if it has been
+   /// removed.
+   EventSource * source(size_t indx);
+
+   /// True if the indx-th source has neither been removed nor
+   /// finished providing events.
+   bool active(size_t indx) const {
+      return m_active.at(indx);
+   }
+
+   /// The name of the indx-th source.
+   const std::string & name(size_t indx) const {
+      return m_names.at(indx);
+   }
+
+   /// The ID number of events from the indx-th source.
+   int id(size_t indx) const {
+      return m_idOffset + static_cast<int>(indx);
+   }
+
+   /// The next photon event, with its arrival after time.  Return 0 if
+   /// none of the sources will provide any more events.
+   EventSource * event(double time);
+
+   /// The time from the given time to the arrival of the event
+   /// returned by the most recent call to event(...).
+   double interval(double time) const {
+      return m_arrival - time;
+   }
+
+   /// ID number of the source for the most recent event.
+   int numSource() const {
+      return m_code;
+   }
+
+   /// Move the sources past an interval, ending at time, in which no
+   /// photons are wanted.  Only the sources with an arrival in that
+   /// interval have their next arrival drawn again, from time; this
+   /// assumes that their arrivals are memoryless.  The other sources,
+   /// including periodic and transient ones, keep their arrivals, and
+   /// deleted sources among them are not recreated.  Before the first
+   /// call to event(...), the first arrivals of all sources are drawn
+   /// from time.
+   void reset(double time);
+
+   /// Delete the sources created by name whose next arrival is at or
+   /// after time.
+   void setHorizon(double time) {
+      m_horizon = time;
+   }
+
+   void setIdOffset(int offset) {
+      m_idOffset = offset;
+   }
+
+   /// The number of sources, including any that have been removed.
+   size_t size() const {
+      return m_sources.size();
+   }
+
+   /// The number of sources currently held in memory.
+   size_t residentSources() const;
+
+   /// The index of the source that provided the most recent event,
+   /// or -1 if there is none.
+   long currentSource() const {
+      return m_pending;
+   }
+
+   /// The ID number for a photon from the indx-th source with the
+   /// given name.  Names other than that of the source itself are
+   /// those of nested sources.
+   int sourceId(size_t indx, const std::string & name);
+
+   /// Draw the random numbers for the indx-th source from its own
+   /// engine.  This engine is made current whenever the source draws
+   /// a photon, and it remains current until the next call to
+   /// event(...), so that it is also used to process that photon.
+   /// Sources without their own engines use the engine that was
+   /// current when this was first called.  The scheduler takes
+   /// ownership of the engine.
+   void setEngine(size_t indx, CLHEP::HepRandomEngine * engine);
+
+   /// Restore the engine that was current before any per-source
+   /// engines were set.
+   void useDefaultEngine();
+
+private:
+
+   /// The sources and their names.  Removed sources, and those added
+   /// by name that are not currently created, are null.
+   std::vector<EventSource *> m_sources;
+   std::vector<std::string> m_names;
+
+   /// Whether each source was added by name and whether it has not
+   /// been removed.
+   std::vector<bool> m_byName;
+   std::vector<bool> m_active;
+
+   FluxMgr * m_fluxMgr;
+   double m_horizon;
+
+   /// Next arrival time for each active source, keyed by index into
+   /// m_sources.  Earliest arrival is on top.
+   typedef std::pair<double, size_t> Arrival_t;
+   std::priority_queue<Arrival_t, std::vector<Arrival_t>,
+                       std::greater<Arrival_t> > m_queue;
+
+   /// The photon generated by each source when its queued arrival was
+   /// drawn, or null if the source has been deleted since.
+   std::vector<EventSource *> m_photons;
+
+   bool m_started;
+
+   /// The source providing the most recent event and its arrival
+   /// time.  Its next arrival is only drawn on the following call to
+   /// event(...) since the photon must be processed first.
+   long m_pending;
+   double m_pendingTime;
+
+   /// The most recent event, its arrival time and source ID.
+   EventSource * m_recent;
+   double m_arrival;
+   int m_code;
+
+   /// ID numbers for sources nested in composite sources, keyed by
+   /// name.  These are assigned after those of the top-level sources.
+   std::map<std::string, int> m_nestedIds;
+
+   int m_idOffset;
+
+   /// Per-source random number engines, which may be null, and the
+   /// engine used by the other sources.
+   std::vector<CLHEP::HepRandomEngine *> m_engines;
+   CLHEP::HepRandomEngine * m_defaultEngine;
+
+   /// Draw the next photon and arrival time for a source, from time,
+   /// and add them to the queue if the source is still active.
+   void schedule(size_t indx, double time);
+
+   /// Delete the indx-th source if it was added by name, in which
+   /// case it will be recreated when it is next needed.  If it has
+   /// finished providing events, it is deleted in any case and marked
+   /// as inactive.
+   void release(size_t indx, bool finished=false);
+
+   /// Make the engine for the indx-th source current.
+   void selectEngine(size_t indx);
+
+};
+
+} // namespace observationSim
+
+#endif // observationSim_SourceScheduler_h
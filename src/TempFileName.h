@@ -0,0 +1,48 @@
+/**
+ * @file TempFileName.h
+ * @brief Temporary file names that are unique to the writing process.
+ *
+ * $Header$
+ */
+
+#ifndef observationSim_TempFileName_h
+#define observationSim_TempFileName_h
+
+#include <sstream>
+#include <string>
+
+#ifndef WIN32
+#include <unistd.h>
+#else
+#include <process.h>
+#endif
+
+namespace observationSim {
+
+/**
+ * @brief A temporary name under which to write a file before it is
+ * renamed into place.
+ *
+ * The host name and process ID are appended to the file name, so that
+ * concurrent runs, including runs on other hosts that share the
+ * directory, each write their own temporary file.
+ */
+inline std::string tempFileName(const std::string & filename) {
+   std::ostringstream name;
+   name << filename << ".tmp.";
+#ifndef WIN32
+   char host[256];
+   if (::gethostname(host, sizeof(host)) == 0) {
+      host[sizeof(host) - 1] = '\0';
+      name << host << ".";
+   }
+   name << ::getpid();
+#else
+   name << ::_getpid();
+#endif
+   return name.str();
+}
+
+} // namespace observationSim
+
+#endif // observationSim_TempFileName_h
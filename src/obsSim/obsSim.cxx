@@ -10,8 +10,15 @@
 #include <fenv.h>
 #endif
 
+#include <sys/stat.h>
+
+#include <cmath>
 #include <cstdlib>
+
+#include <algorithm>
+#include <map>
 #include <memory>
+#include <sstream>
 #include <stdexcept>
 
 #include "CLHEP/Random/Random.h"
@@ -49,18 +56,38 @@
 #include "celestialSources/SpectrumFactoryLoader.h"
 
 #include "observationSim/Simulator.h"
+#include "observationSim/AsyncWriter.h"
 #include "observationSim/EventContainer.h"
+#include "observationSim/MemoryBudget.h"
 #include "observationSim/ScDataContainer.h"
 
+#include "EventCache.h"
+#include "Ft1EventFeed.h"
 #include "LatSc.h"
+#include "SourceModelCache.h"
 
 using st_facilities::Util;
 
+namespace {
+/// The size and modification time of a file, to identify its contents
+/// without reading it, or "none" if it cannot be found.
+   std::string fileStamp(const std::string & filename) {
+      struct stat info;
+      if (stat(filename.c_str(), &info) != 0) {
+         return "none";
+      }
+      std::ostringstream stamp;
+      stamp << info.st_size << " " << info.st_mtime;
+      return stamp.str();
+   }
+}
+
 class ObsSim : public st_app::StApp {
 public:
    ObsSim() : st_app::StApp(), m_pars(st_app::StApp::getParGroup("gtobssim")),
               m_simulator(0), 
-              m_formatter(new st_stream::StreamFormatter("gtobssim", "", 2)) {
+              m_formatter(new st_stream::StreamFormatter("gtobssim", "", 2)),
+              m_psfMargin(0) {
       setVersion(s_cvs_id);
    }
    virtual ~ObsSim() throw() {
@@ -87,17 +114,28 @@ private:
    st_stream::StreamFormatter * m_formatter;
    double m_tstart;
 
+   /// Padding (degrees) of the acceptance cone for the PSF.
+   double m_psfMargin;
+
    void promptForParameters();
    void checkOutputFiles();
    void setRandomSeed();
    void createFactories();
    void setXmlFiles();
    void readSrcNames();
+   void useSourceModelCache();
+   void useEventCache();
    void createResponseFuncs();
    void createSimulator();
    void generateData();
+   void generateScData();
    void saveEventIds(const observationSim::EventContainer & events) const;
+   size_t memoryBudget() const;
+   observationSim::AsyncWriter * asyncWriter() const;
+   unsigned int chunkRows() const;
+   void reportMemoryUse(const observationSim::MemoryBudget & budget) const;
    double maxEffArea() const;
+   double psfMargin() const;
    void get_tstart(std::string scfile, const std::string & sctable);
 
    static std::string s_cvs_id;
@@ -120,14 +158,28 @@ void ObsSim::run() {
    setRandomSeed();
    createFactories();
    setXmlFiles();
-   readSrcNames();
-   createResponseFuncs();
-   createSimulator();
-   generateData();
+   if (m_pars["scdata_only"]) {
+      createSimulator();
+      generateScData();
+   } else {
+      readSrcNames();
+      useSourceModelCache();
+      createResponseFuncs();
+      createSimulator();
+      generateData();
+   }
    m_formatter->info() << "Done." << std::endl;
 }
 
 void ObsSim::promptForParameters() {
+   if (m_pars["scdata_only"]) {
+      m_pars.Prompt("evroot");
+      m_pars.Prompt("simtime");
+      m_pars.Prompt("tstart");
+      m_pars.Save();
+      m_count = m_pars["simtime"];
+      return;
+   }
    m_pars.Prompt("infile");
    m_pars.Prompt("srclist");
    m_pars.Prompt("scfile");
@@ -150,7 +202,9 @@ void ObsSim::checkOutputFiles() {
    bool clobber = m_pars["clobber"];
    if (!clobber) {
       std::string prefix = m_pars["evroot"];
-      std::string file = prefix + "_events_0000.fits";
+      bool compress = m_pars["compress"];
+      std::string suffix(compress ? ".fits.gz" : ".fits");
+      std::string file = prefix + "_events_0000" + suffix;
       if (st_facilities::Util::fileExists(file)) {
          m_formatter->err() << "Output file " << file  << " already exists,\n"
                             << "and you have set 'clobber' to 'no'.\n"
@@ -158,7 +212,7 @@ void ObsSim::checkOutputFiles() {
                             << std::endl;
          std::exit(1);
       }
-      file = prefix + "_scData_0000.fits";
+      file = prefix + "_scData_0000" + suffix;
       if (st_facilities::Util::fileExists(file)) {
          m_formatter->err() << "Output file " << file << " already exists,\n"
                             << "and you have set 'clobber' to 'no'.\n"
@@ -182,10 +236,15 @@ void ObsSim::createFactories() {
 
 void ObsSim::setXmlFiles() {
    m_xmlSourceFiles.clear();
-// observationSim::Simulator requires a specific "TimeCandle" source,
-// so time_source.xml must always be loaded.
+// time_source.xml is always loaded.  It is the only file needed when
+// generating spacecraft data alone.
    m_xmlSourceFiles.push_back(facilities::commonUtilities::joinPath(st_facilities::Environment::xmlPath("observationSim"), "time_source.xml"));
 
+// No photon sources are needed if only spacecraft data are generated.
+   if (m_pars["scdata_only"]) {
+      return;
+   }
+
 // Fetch any user-specified xml file of flux-style source definitions,
 // replacing the default list.
    std::string xmlFiles = m_pars["infile"];
@@ -227,6 +286,87 @@ void ObsSim::readSrcNames() {
    }
 }   
 
+void ObsSim::useSourceModelCache() {
+   std::string cacheDir = m_pars["srccache"];
+   if (cacheDir == "none" || cacheDir == "") {
+      return;
+   }
+   facilities::Util::expandEnvVar(&cacheDir);
+// time_source.xml is small and is always loaded as is.  The "default"
+// source is used by the Simulator to set the LAT cross-section.
+   std::vector<std::string> xmlFiles(m_xmlSourceFiles.begin() + 1,
+                                     m_xmlSourceFiles.end());
+   std::vector<std::string> srcNames(m_srcNames);
+   srcNames.push_back("default");
+   try {
+      observationSim::SourceModelCache cache(cacheDir);
+      std::string modelFile(cache.modelFile(xmlFiles, srcNames));
+      m_xmlSourceFiles.resize(1);
+      m_xmlSourceFiles.push_back(modelFile);
+      m_formatter->info(3) << (cache.hit() ? "Using cached" : "Created")
+                           << " source model " << modelFile << std::endl;
+   } catch (std::exception & eObj) {
+      m_formatter->info() << "Not using the source model cache: "
+                          << eObj.what() << std::endl;
+   }
+}
+
+void ObsSim::useEventCache() {
+   std::string cacheDir = m_pars["evcache"];
+   if (cacheDir == "none" || cacheDir == "") {
+      return;
+   }
+   facilities::Util::expandEnvVar(&cacheDir);
+   if (m_pars["nevents"]) {
+      m_formatter->info() << "Event caches are not used when "
+                          << "nevents=yes." << std::endl;
+      return;
+   }
+// The parameters that affect the events from every source.  These
+// are combined with each source's xml definition to form its key.
+   const char * parNames[] = {"seed", "simtime", "startdate", "maxtime",
+                              "scfile", "sctable", "rockangle", "ltfrac", 
+                              "use_ac", "ra", "dec", "radius", "emin",
+                              "emax", "edisp", "irfs", "evtype", "area"};
+   std::ostringstream common;
+   common.precision(17);
+   common << "format=" << observationSim::EventCacheWriter::s_formatVersion
+          << "\n" << "tstart=" << m_tstart << "\n";
+   for (size_t i = 0; i < sizeof(parNames)/sizeof(parNames[0]); i++) {
+      std::string value("INDEF");
+      try {
+         std::string parValue = m_pars[parNames[i]];
+         value = parValue;
+      } catch (...) {
+      }
+      common << parNames[i] << "=" << value << "\n";
+   }
+// The pointing history can change without its name changing.
+   std::string scfile = m_pars["scfile"];
+   facilities::Util::expandEnvVar(&scfile);
+   common << "scfile_stamp=" << fileStamp(scfile) << "\n";
+   std::vector<std::string> xmlFiles(m_xmlSourceFiles.begin() + 1,
+                                     m_xmlSourceFiles.end());
+   std::map<std::string, std::string> definitions;
+   try {
+      observationSim::SourceModelCache::sourceDefinitions(xmlFiles,
+                                                          m_srcNames,
+                                                          definitions);
+   } catch (std::exception & eObj) {
+      m_formatter->info() << "Not using event caches: " 
+                          << eObj.what() << std::endl;
+      return;
+   }
+   std::map<std::string, std::string> keys;
+   for (std::map<std::string, std::string>::const_iterator 
+           def = definitions.begin(); def != definitions.end(); ++def) {
+      keys[def->first] = 
+         observationSim::SourceModelCache::hashKey(common.str() 
+                                                   + def->second);
+   }
+   m_simulator->setEventCache(cacheDir, keys);
+}
+
 void ObsSim::createResponseFuncs() {
    irfLoader::Loader::go();
    irfInterface::IrfsFactory * myFactory 
@@ -299,13 +439,69 @@ void ObsSim::createSimulator() {
       maxSimTime = m_pars["maxtime"];
    } catch (std::exception &) {
    }
-   m_simulator = new observationSim::Simulator(m_srcNames, m_xmlSourceFiles, 
-                                               totalArea, m_tstart,
-                                               pointingHistory, maxSimTime,
-                                               offset);
-
-   int id_offset = m_pars["offset"];
-   m_simulator->setIdOffset(id_offset);
+   if (m_pars["scdata_only"]) {
+      if (pointingHistory != "none" && pointingHistory != "") {
+         throw std::invalid_argument("scdata_only=yes requires scfile=none.");
+      }
+      m_simulator = new observationSim::Simulator(m_xmlSourceFiles, m_tstart,
+                                                  maxSimTime);
+   } else {
+      m_simulator = new observationSim::Simulator(m_srcNames, 
+                                                  m_xmlSourceFiles, 
+                                                  totalArea, m_tstart,
+                                                  pointingHistory, maxSimTime,
+                                                  offset);
+      int id_offset = m_pars["offset"];
+// The MC_SRC_ID values of merged background events are kept, so the
+// simulated sources are numbered after them.
+      std::string bkgFile = m_pars["bkgfile"];
+      facilities::Util::expandEnvVar(&bkgFile);
+      if (bkgFile != "" && bkgFile != "none") {
+         std::string evTable = m_pars["evtable"];
+         int maxId(observationSim::Ft1EventFeed::maxSourceId(bkgFile,
+                                                             evTable));
+         if (maxId >= id_offset) {
+            m_formatter->info() << "The MC_SRC_ID values in " << bkgFile
+                                << " go up to " << maxId << "; "
+                                << "numbering the simulated sources from "
+                                << maxId + 1 << " instead of "
+                                << id_offset << "." << std::endl;
+            id_offset = maxId + 1;
+         }
+      }
+      m_simulator->setIdOffset(id_offset);
+      if (m_pars["use_ac"]) {
+         double ra = m_pars["ra"];
+         double dec = m_pars["dec"];
+         double radius = m_pars["radius"];
+         astro::SkyDir roiCenter(ra, dec);
+         m_psfMargin = psfMargin();
+         if (m_psfMargin < 180.) {
+            m_formatter->info() << "Padding the acceptance cone by "
+                                << m_psfMargin << " degrees for the PSF."
+                                << std::endl;
+            m_simulator->pruneSources(roiCenter, radius + m_psfMargin);
+         } else {
+            m_formatter->info() << "The PSF at the lowest simulated "
+                                << "energy is too broad to bound; "
+                                << "no sources will be pruned."
+                                << std::endl;
+         }
+      }
+      std::string expSrcList = m_pars["expsrclist"];
+      if (expSrcList != "none" && expSrcList != "") {
+         if (!Util::fileExists(expSrcList)) {
+            throw std::invalid_argument("Exposure source list " + expSrcList
+                                        + " doesn't exist.");
+         }
+         std::vector<std::string> expSrcNames;
+         Util::readLines(expSrcList, expSrcNames, "#", true);
+         m_simulator->setExposureSources(expSrcNames);
+      }
+      useEventCache();
+   }
+   double ft2_interval = m_pars["ft2_interval"];
+   m_simulator->setScDataInterval(ft2_interval);
 
    if (pointingHistory == "none" || pointingHistory == "") {
       try {
@@ -367,12 +563,27 @@ void ObsSim::generateData() {
       stop_time = start_time + sim_time;
    }
    bool applyEdisp = m_pars["edisp"];
+   std::unique_ptr<observationSim::AsyncWriter> writer(asyncWriter());
+   observationSim::MemoryBudget budget(memoryBudget());
    observationSim::EventContainer events(prefix + "_events", ev_table,
                                          cuts, nMaxRows,
                                          start_time, stop_time, applyEdisp,
                                          &m_pars);
    events.setAppName("gtobssim");
    events.setVersion(getVersion());
+   bool useRoi(m_pars["use_ac"] && m_psfMargin < 180.);
+   if (useRoi) {
+      double ra = m_pars["ra"];
+      double dec = m_pars["dec"];
+      double radius = m_pars["radius"];
+      events.setRoi(astro::SkyDir(ra, dec), radius + m_psfMargin);
+   }
+   typedef std::vector<std::pair<std::string, int> > pruned_t;
+   const pruned_t & pruned(m_simulator->prunedSources());
+   for (pruned_t::const_iterator src = pruned.begin(); 
+        src != pruned.end(); ++src) {
+      events.addSourceSummary(src->first, src->second);
+   }
    std::string pointingHistory = m_pars["scfile"];
    facilities::Util::expandEnvVar(&pointingHistory);
    bool writeScData = (pointingHistory == "" || pointingHistory == "none"
@@ -382,14 +593,38 @@ void ObsSim::generateData() {
                                           nMaxRows, writeScData, &m_pars);
    scData.setAppName("gtobssim");
    scData.setVersion(getVersion());
-   observationSim::Spacecraft * spacecraft(0);
+   events.setMemoryBudget(&budget);
+   scData.setMemoryBudget(&budget);
+   events.setWriter(writer.get());
+   scData.setWriter(writer.get());
+   events.setChunkRows(chunkRows());
+   scData.setChunkRows(chunkRows());
+   bool compress = m_pars["compress"];
+   events.setCompression(compress);
+   scData.setCompression(compress);
+   observationSim::LatSc * spacecraft(0);
    if (writeScData) {
       spacecraft = new observationSim::LatSc();
    } else {
-      spacecraft = new observationSim::LatSc(pointingHistory);
+      spacecraft = new observationSim::LatSc(pointingHistory, start_time,
+                                             stop_time);
    }
    double frac = m_pars["ltfrac"];
    spacecraft->setLivetimeFrac(frac);
+   std::string bkgFile = m_pars["bkgfile"];
+   facilities::Util::expandEnvVar(&bkgFile);
+   if (bkgFile != "" && bkgFile != "none") {
+      if (writeScData) {
+         throw std::invalid_argument("The FT2 file for the events in "
+                                     + bkgFile + " must be given as scfile.");
+      }
+      m_formatter->info() << "Merging events from " << bkgFile 
+                          << std::endl;
+      m_simulator->addEventFeed(new observationSim::Ft1EventFeed(bkgFile,
+                                                                 ev_table,
+                                                                 start_time,
+                                                                 spacecraft));
+   }
    if (m_pars["nevents"]) {
       m_formatter->info() << "Generating " << m_count 
                           << " events...." << std::endl;
@@ -404,11 +639,63 @@ void ObsSim::generateData() {
 
    if (writeScData) {
 // Pad with one more row of ScData.
-      double time = scData.simTime() + 30.;
+      double time = scData.simTime() + m_simulator->scDataInterval();
       scData.addScData(time, spacecraft);
+   } else {
+      m_formatter->info(3) << "Read " << spacecraft->rowsRead() 
+                           << " rows of livetimes from " << pointingHistory
+                           << "; peak size of the livetime window: "
+                           << spacecraft->peakWindowSize() << " bytes.  "
+                           << "The attitude and orbit are read from the "
+                           << "whole file." << std::endl;
    }
 
+// Complete the files here rather than in the destructors, so that
+// any write error is reported.
+   events.close();
+   scData.close();
+   if (writer) {
+      writer->wait();
+   }
+   if (useRoi) {
+      m_formatter->info() << "Discarded " << events.roiRejected()
+                          << " photons from outside the padded "
+                          << "acceptance cone." << std::endl;
+   }
    saveEventIds(events);
+   reportMemoryUse(budget);
+}
+
+void ObsSim::generateScData() {
+   long nMaxRows = m_pars["maxrows"];
+   std::string prefix = m_pars["evroot"];
+   std::string sc_table = m_pars["sctable"];
+   std::unique_ptr<observationSim::AsyncWriter> writer(asyncWriter());
+   observationSim::MemoryBudget budget(memoryBudget());
+   observationSim::ScDataContainer scData(prefix + "_scData", sc_table,
+                                          nMaxRows, true, &m_pars);
+   scData.setAppName("gtobssim");
+   scData.setVersion(getVersion());
+   scData.setMemoryBudget(&budget);
+   scData.setWriter(writer.get());
+   scData.setChunkRows(chunkRows());
+   bool compress = m_pars["compress"];
+   scData.setCompression(compress);
+   observationSim::LatSc spacecraft;
+   double frac = m_pars["ltfrac"];
+   spacecraft.setLivetimeFrac(frac);
+   m_formatter->info() << "Generating spacecraft data for a simulation time of "
+                       << m_count << " seconds...." << std::endl;
+   m_simulator->generateScData(m_count, scData, &spacecraft);
+
+// Pad with one more row of ScData.
+   double time = scData.simTime() + m_simulator->scDataInterval();
+   scData.addScData(time, &spacecraft);
+   scData.close();
+   if (writer) {
+      writer->wait();
+   }
+   reportMemoryUse(budget);
 }
 
 void ObsSim::
@@ -444,6 +731,43 @@ saveEventIds(const observationSim::EventContainer & events) const {
    outputFile.close();
 }
 
+size_t ObsSim::memoryBudget() const {
+   double membudget = m_pars["membudget"];
+   if (membudget < 0) {
+      throw std::invalid_argument("membudget must be non-negative.");
+   }
+   return static_cast<size_t>(membudget*1024.*1024.);
+}
+
+unsigned int ObsSim::chunkRows() const {
+   int chunkrows = m_pars["chunkrows"];
+   if (chunkrows < 0) {
+      throw std::invalid_argument("chunkrows must be non-negative.");
+   }
+   return chunkrows;
+}
+
+observationSim::AsyncWriter * ObsSim::asyncWriter() const {
+   bool asyncwrite = m_pars["asyncwrite"];
+   if (!asyncwrite) {
+      return 0;
+   }
+   return new observationSim::AsyncWriter();
+}
+
+void ObsSim::
+reportMemoryUse(const observationSim::MemoryBudget & budget) const {
+   m_formatter->info() << "Peak size of output buffers: "
+                       << budget.peakBytes()/1024 << " kB";
+   if (budget.maxBytes() > 0) {
+      m_formatter->info() << " (budget " << budget.maxBytes()/1024
+                          << " kB)";
+   }
+   m_formatter->info() << "; peak resident set size: " 
+                       << observationSim::MemoryBudget::peakRss()/1024
+                       << " kB" << std::endl;
+}
+
 double ObsSim::maxEffArea() const {
    if (m_respPtrs.empty()) {
       double effArea = m_pars["area"];
@@ -461,6 +785,17 @@ double ObsSim::maxEffArea() const {
    return total/1e4;
 }
 
+double ObsSim::psfMargin() const {
+// The PSF is evaluated at the lowest energy that can be simulated.
+// With energy dispersion, photons with true energies below emin can
+// pass the energy cut; those more than a factor of 10 below it
+// essentially never do.
+   double emin = m_pars["emin"];
+   bool edisp = m_pars["edisp"];
+   double energy(edisp ? emin/10. : emin);
+   return observationSim::EventContainer::psfMargin(m_respPtrs, energy);
+}
+
 void ObsSim::get_tstart(std::string scfile, const std::string & sctable) {
    facilities::Util::expandEnvVar(&scfile);
    std::unique_ptr<const tip::Table>
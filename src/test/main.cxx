@@ -9,35 +9,113 @@
 #include <fenv.h>
 #endif
 
+#include <cmath>
+#include <cstdio>
 #include <cstdlib>
 
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <future>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <memory>
+#include <numeric>
+#include <sstream>
+#include <stdexcept>
+
+#include "CLHEP/Random/RandFlat.h"
+
 #include "facilities/commonUtilities.h"
 
 #include "astro/SkyDir.h"
 
 #include "st_facilities/Environment.h"
+#include "st_facilities/Util.h"
+
+#include "tip/IFileSvc.h"
+#include "tip/Table.h"
 
 #include "irfInterface/IrfsFactory.h"
 #include "irfLoader/Loader.h"
 
 #include "celestialSources/SpectrumFactoryLoader.h"
 
+#include "flux/EventSource.h"
+#include "flux/FluxMgr.h"
+
 #include "dataSubselector/Cuts.h"
 
+#include "observationSim/AsyncWriter.h"
+#include "observationSim/Event.h"
 #include "observationSim/Simulator.h"
 #include "observationSim/EventContainer.h"
+#include "observationSim/MemoryBudget.h"
 #include "observationSim/ScDataContainer.h"
+#include "EventGeometry.h"
+#include "Ft1EventFeed.h"
 #include "LatSc.h"
+#include "SourceModelCache.h"
+#include "SourceScheduler.h"
 
 void help();
 
 void load_sources();
 
+void test_event_geometry();
+
+void test_async_writer();
+
+void test_event_buffer();
+
+void test_ft1_write_rate();
+
+void test_ft2_write_rate();
+
+void test_chunked_output();
+
+void test_memory_budget();
+
+void test_gzip_output();
+
+void test_roi_rejection(std::vector<irfInterface::Irfs *> & respPtrs,
+                        observationSim::Spacecraft * spacecraft);
+
+void test_exposure_sampler(std::vector<irfInterface::Irfs *> & respPtrs,
+                           const std::vector<std::string> & fileList);
+
+void test_dead_intervals(std::vector<irfInterface::Irfs *> & respPtrs,
+                         const std::vector<std::string> & fileList);
+
+void test_event_cache(std::vector<irfInterface::Irfs *> & respPtrs,
+                      const std::vector<std::string> & fileList);
+
+void test_ft1_merge(std::vector<irfInterface::Irfs *> & respPtrs,
+                    const std::vector<std::string> & fileList);
+
+void test_source_model_cache(const std::vector<std::string> & fileList);
+
+void test_lazy_sources();
+
+void test_source_scheduler();
+
 int main(int iargc, char * argv[]) {
 #ifdef TRAP_FPE
    feenableexcept (FE_INVALID|FE_DIVBYZERO|FE_OVERFLOW);
 #endif
 
+   test_event_geometry();
+   test_async_writer();
+   test_event_buffer();
+   test_ft1_write_rate();
+   test_ft2_write_rate();
+   test_chunked_output();
+   test_memory_budget();
+   test_gzip_output();
+
 // Create list of xml input files for source definitions.
    std::vector<std::string> fileList;
    std::string xml_list(facilities::commonUtilities::joinPath(st_facilities::Environment::xmlPath("observationSim"), "obsSim_source_library.xml"));
@@ -53,6 +131,10 @@ int main(int iargc, char * argv[]) {
 
    load_sources();
 
+   test_source_model_cache(fileList);
+   test_lazy_sources();
+   test_source_scheduler();
+
 // Parse the command line arguments.
 //
 // The first argument will be the total number of photons or the total
@@ -117,6 +199,12 @@ int main(int iargc, char * argv[]) {
 // The spacecraft object.
    observationSim::Spacecraft *spacecraft = new observationSim::LatSc();
 
+   test_roi_rejection(respPtrs, spacecraft);
+   test_exposure_sampler(respPtrs, fileList);
+   test_dead_intervals(respPtrs, fileList);
+   test_event_cache(respPtrs, fileList);
+   test_ft1_merge(respPtrs, fileList);
+
 // Use simulation time rather than total counts if desired.
    if (useSimTime) {
       std::cout << "Generating events for a simulation time of "
@@ -141,3 +229,915 @@ void help() {
 void load_sources() {
    SpectrumFactoryLoader foo;
 }
+
+namespace {
+   CLHEP::Hep3Vector randomDir() {
+      double z(2.*CLHEP::RandFlat::shoot() - 1.);
+      double phi(2.*M_PI*CLHEP::RandFlat::shoot());
+      double r(std::sqrt(1. - z*z));
+      return CLHEP::Hep3Vector(r*std::cos(phi), r*std::sin(phi), z);
+   }
+
+/// Earth azimuth as computed per event before the block computation,
+/// from FT1worker::Evaluate in AnalysisNtuple.
+   double earthAzimuth(const astro::SkyDir & sdir,
+                       const astro::SkyDir & zenith) {
+      CLHEP::Hep3Vector north_pole(0, 0, 1);
+      CLHEP::Hep3Vector east_dir(north_pole.cross(zenith()).unit());
+      CLHEP::Hep3Vector north_dir(zenith().cross(east_dir));
+      double azimuth(std::atan2(sdir().dot(east_dir),
+                                sdir().dot(north_dir)));
+      if (azimuth < 0) {
+         azimuth += 2*M_PI;
+      }
+      if (std::fabs(azimuth) < 1e-8) {
+         azimuth = 0;
+      }
+      return azimuth*180./M_PI;
+   }
+
+/// True if a single precision angle (degrees) is within one unit in
+/// the last place of the reference value, allowing for the wrap at
+/// 360 degrees.
+   bool sameAngle(float value, double reference) {
+      double diff(std::fabs(value - reference));
+      diff = std::min(diff, std::fabs(diff - 360.));
+      return diff <= std::numeric_limits<float>::epsilon()
+         *std::max(std::fabs(reference), 1.);
+   }
+}
+
+void test_event_geometry() {
+// Compare the block computation of the FT1 direction columns with the
+// per-event SkyDir formulae for random directions and attitudes.
+   const size_t nblocks(400);
+   const size_t blockSize(observationSim::EventGeometry::s_blockSize);
+   const char * names[] = {"RA", "DEC", "L", "B", "THETA", "PHI",
+                           "ZENITH_ANGLE", "EARTH_AZIMUTH_ANGLE"};
+   size_t nbad[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+   observationSim::EventGeometry geometry;
+   std::vector<observationSim::Event> events;
+   std::vector<float> columns[8];
+   for (size_t block = 0; block < nblocks; block++) {
+      events.clear();
+      for (size_t i = 0; i < blockSize; i++) {
+         CLHEP::Hep3Vector appDir(randomDir());
+         CLHEP::Hep3Vector zAxis(randomDir());
+         CLHEP::Hep3Vector xAxis(randomDir());
+         xAxis = (xAxis - xAxis.dot(zAxis)*zAxis).unit();
+         CLHEP::Hep3Vector zenith(randomDir());
+         geometry.add(appDir, zAxis, xAxis, zenith);
+         astro::SkyDir dir(appDir, astro::SkyDir::EQUATORIAL);
+         events.push_back(observationSim::Event(
+                             0, 100., dir, dir,
+                             astro::SkyDir(zAxis, astro::SkyDir::EQUATORIAL),
+                             astro::SkyDir(xAxis, astro::SkyDir::EQUATORIAL),
+                             astro::SkyDir(zenith, astro::SkyDir::EQUATORIAL),
+                             0));
+      }
+      for (size_t k = 0; k < 8; k++) {
+         columns[k].resize(blockSize);
+      }
+      geometry.compute(&columns[0][0], &columns[1][0], &columns[2][0],
+                       &columns[3][0], &columns[4][0], &columns[5][0],
+                       &columns[6][0], &columns[7][0]);
+      for (size_t i = 0; i < blockSize; i++) {
+         const observationSim::Event & event(events[i]);
+         double reference[8] = {event.appDir().ra(), event.appDir().dec(),
+                                event.appDir().l(), event.appDir().b(),
+                                event.theta(), event.phi(),
+                                event.zenAngle(),
+                                earthAzimuth(event.appDir(),
+                                             event.zenith())};
+         for (size_t k = 0; k < 8; k++) {
+            if (!sameAngle(columns[k][i], reference[k])) {
+               nbad[k]++;
+            }
+         }
+      }
+   }
+   std::ostringstream message;
+   for (size_t k = 0; k < 8; k++) {
+      if (nbad[k] > 0) {
+         message << " " << names[k] << ": " << nbad[k];
+      }
+   }
+   if (message.str() != "") {
+      throw std::runtime_error("EventGeometry differs from the per-event "
+                               "values for" + message.str());
+   }
+   std::cout << "EventGeometry agrees with the per-event values for "
+             << nblocks*blockSize << " events." << std::endl;
+}
+
+namespace {
+   bool throws(const std::function<void()> & call,
+               const std::string & message) {
+      try {
+         call();
+      } catch (std::runtime_error & eObj) {
+         return eObj.what() == message;
+      }
+      return false;
+   }
+}
+
+void test_async_writer() {
+// The writes are run one at a time, in the order submitted.
+   std::vector<int> order;
+   {
+      observationSim::AsyncWriter writer(2);
+      for (int i = 0; i < 100; i++) {
+         writer.submit([&order, i]() {order.push_back(i);});
+      }
+      writer.wait();
+   }
+   for (int i = 0; i < 100; i++) {
+      if (order.size() != 100 || order[i] != i) {
+         throw std::runtime_error("AsyncWriter did not run the writes "
+                                  "in order.");
+      }
+   }
+
+// A failed write discards the writes queued after it, and its
+// exception is rethrown by every later submit() and wait().  The
+// first write is held until the others are queued.
+   observationSim::AsyncWriter writer(4);
+   std::promise<void> release;
+   std::shared_future<void> released(release.get_future());
+   std::vector<int> done;
+   writer.submit([&done, released]() {
+         released.wait();
+         done.push_back(0);
+      });
+   writer.submit([]() {throw std::runtime_error("write failed");});
+   writer.submit([&done]() {done.push_back(2);});
+   release.set_value();
+   if (!throws([&writer]() {writer.wait();}, "write failed")
+       || !throws([&writer]() {writer.submit([]() {});}, "write failed")
+       || !throws([&writer]() {writer.wait();}, "write failed")) {
+      throw std::runtime_error("AsyncWriter did not rethrow the "
+                               "exception of a failed write.");
+   }
+   if (done.size() != 1 || done[0] != 0) {
+      throw std::runtime_error("AsyncWriter ran the writes queued after "
+                               "a failed one.");
+   }
+   std::cout << "AsyncWriter runs the writes in order and rethrows "
+             << "their exceptions." << std::endl;
+}
+
+void test_roi_rejection(std::vector<irfInterface::Irfs *> & respPtrs,
+                        observationSim::Spacecraft * spacecraft) {
+// The photons of a source just outside the padded acceptance cone are
+// discarded by the early rejection, so none of them produce events.
+// Without it, the PSF may scatter no more than the leakage bound of
+// them into the cone.
+   const double energy(1e4);
+   const double radius(10.);
+   double margin(observationSim::EventContainer::psfMargin(respPtrs, energy,
+                                                           90.));
+   if (margin >= 180.) {
+      throw std::runtime_error("The PSF margin at 10 GeV is not bounded.");
+   }
+   dataSubselector::Cuts cuts;
+   cuts.addSkyConeCut(0, 0, radius);
+   observationSim::EventContainer events("test_roi", "EVENTS", &cuts);
+   astro::SkyDir sourceDir(radius + margin + 0.5, 0);
+   const long nphot(20000);
+   for (long i = 0; i < nphot; i++) {
+      double time(i);
+      CLHEP::Hep3Vector launchDir(-(spacecraft->InstrumentToCelestial(time)
+                                    .inverse()*sourceDir()));
+      events.addDetectedEvent(time, energy, launchDir, sourceDir,
+                              respPtrs[i % respPtrs.size()], spacecraft,
+                              "roi_test_source", 0, false);
+   }
+   unsigned long withRejection(0);
+   unsigned long withoutRejection(events.eventIds()
+                                  .find("roi_test_source")->second
+                                  .acceptedNum);
+   double expected(nphot*observationSim::EventContainer::s_psfLeakage);
+   if (withoutRejection - withRejection
+       > expected + 3.*std::sqrt(expected) + 1.) {
+      throw std::runtime_error("Early rejection changes the counts within "
+                               "the acceptance cone.");
+   }
+   std::cout << "A source " << radius + margin + 0.5
+             << " degrees from the acceptance cone center gives "
+             << withoutRejection << " events without early rejection and "
+             << withRejection << " with it." << std::endl;
+}
+
+namespace {
+   double seconds(std::chrono::steady_clock::time_point start) {
+      return std::chrono::duration<double>(std::chrono::steady_clock::now()
+                                           - start).count();
+   }
+
+   bool closeAngle(double value, double reference) {
+      double diff(std::fabs(value - reference));
+      return std::min(diff, std::fabs(diff - 360.)) < 1e-3;
+   }
+
+/// Add events at times 0, 1, 2, ... to the container.
+   void addTestEvents(observationSim::EventContainer & events,
+                      size_t nevents) {
+      astro::SkyDir appDir(83.6, 22.0);
+      astro::SkyDir zAxis(0, 90);
+      astro::SkyDir xAxis(0, 0);
+      for (size_t i = 0; i < nevents; i++) {
+         observationSim::Event event(i, 100. + i, appDir, appDir, zAxis,
+                                     xAxis, zAxis, 0, 1);
+         event.setEventClass(0);
+         events.addCachedEvent(event, "test_source", 1);
+      }
+   }
+
+/// The TIME values of the events in the FT1 files with the given root
+/// name, in the order of the files, and the number of files.
+   std::vector<double> readTimes(const std::string & root,
+                                 size_t & nfiles,
+                                 const std::string & suffix="") {
+      std::vector<double> times;
+      for (nfiles = 0; ; nfiles++) {
+         std::ostringstream filename;
+         filename << root << "_" << std::setw(4) << std::setfill('0')
+                  << nfiles << ".fits" << suffix;
+         if (!st_facilities::Util::fileExists(filename.str())) {
+            return times;
+         }
+         std::unique_ptr<const tip::Table>
+            table(tip::IFileSvc::instance().readTable(filename.str(),
+                                                      "EVENTS"));
+         for (tip::Table::ConstIterator row = table->begin();
+              row != table->end(); ++row) {
+            double time;
+            (*row)["TIME"].get(time);
+            times.push_back(time);
+         }
+      }
+   }
+}
+
+void test_event_buffer() {
+// The column buffers of EventContainer are compared with a vector of
+// Event objects for memory use and for the rate at which events are
+// added, and the events rebuilt by getEvents() are compared with the
+// originals.
+   const size_t nevents(100000);
+   std::vector<observationSim::Event> originals;
+   originals.reserve(nevents);
+   for (size_t i = 0; i < nevents; i++) {
+      CLHEP::Hep3Vector zAxis(randomDir());
+      CLHEP::Hep3Vector xAxis(randomDir());
+      xAxis = (xAxis - xAxis.dot(zAxis)*zAxis).unit();
+      astro::SkyDir appDir(randomDir(), astro::SkyDir::EQUATORIAL);
+      originals.push_back(observationSim::Event(
+                             i, 100., appDir, appDir,
+                             astro::SkyDir(zAxis, astro::SkyDir::EQUATORIAL),
+                             astro::SkyDir(xAxis, astro::SkyDir::EQUATORIAL),
+                             astro::SkyDir(randomDir(),
+                                           astro::SkyDir::EQUATORIAL),
+                             0, 1, 100., 0, 0, 1));
+      originals.back().setEventClass(0);
+   }
+
+   std::chrono::steady_clock::time_point start
+      (std::chrono::steady_clock::now());
+   std::vector<observationSim::Event> vectorEvents;
+   for (size_t i = 0; i < nevents; i++) {
+      vectorEvents.push_back(originals[i]);
+   }
+   double vectorTime(seconds(start));
+
+   observationSim::EventContainer events("test_buffer", "EVENTS", 0,
+                                         nevents + 1);
+   start = std::chrono::steady_clock::now();
+   for (size_t i = 0; i < nevents; i++) {
+      events.addCachedEvent(originals[i], "buffer_test_source", 1);
+   }
+   double bufferTime(seconds(start));
+
+   std::vector<observationSim::Event> rebuilt(events.getEvents());
+   if (rebuilt.size() != nevents) {
+      throw std::runtime_error("EventContainer::getEvents returned the "
+                               "wrong number of events.");
+   }
+   for (size_t i = 0; i < nevents; i++) {
+      const observationSim::Event & event(originals[i]);
+      const observationSim::Event & copy(rebuilt[i]);
+      if (copy.time() != event.time() || copy.energy() != event.energy()
+          || copy.eventId() != event.eventId()
+          || copy.eventType() != event.eventType()
+          || !closeAngle(copy.appDir().ra(), event.appDir().ra())
+          || !closeAngle(copy.appDir().dec(), event.appDir().dec())
+          || !closeAngle(copy.theta(), event.theta())
+          || !closeAngle(copy.phi(), event.phi())
+          || !closeAngle(copy.zenAngle(), event.zenAngle())) {
+         throw std::runtime_error("EventContainer::getEvents differs from "
+                                  "the buffered events.");
+      }
+   }
+   std::cout << "Buffering " << nevents << " events: "
+             << vectorEvents.capacity()*sizeof(observationSim::Event)
+             << " bytes and " << nevents/vectorTime
+             << " events/s as Event objects, "
+             << events.bufferedBytes() << " bytes and "
+             << nevents/bufferTime << " events/s as FT1 columns."
+             << std::endl;
+}
+
+void test_ft1_write_rate() {
+// A million events are written to an FT1 file, against a target of
+// under one second per million rows, and their TIME and EVENT_TYPE
+// values and the GTI are read back.
+   const size_t nevents(1000000);
+   observationSim::EventContainer events("test_ft1_write", "EVENTS", 0,
+                                         nevents + 1);
+   astro::SkyDir appDir(83.6, 22.0);
+   astro::SkyDir zAxis(0, 90);
+   astro::SkyDir xAxis(0, 0);
+   for (size_t i = 0; i < nevents; i++) {
+      observationSim::Event event(i, 100., appDir, appDir, zAxis, xAxis,
+                                  zAxis, 0, 1u << (i % 32));
+      event.setEventClass(0);
+      events.addCachedEvent(event, "write_test_source", 1);
+   }
+   std::chrono::steady_clock::time_point start
+      (std::chrono::steady_clock::now());
+   events.close();
+   double writeTime(seconds(start));
+
+   std::unique_ptr<const tip::Table>
+      table(tip::IFileSvc::instance().readTable("test_ft1_write_0000.fits",
+                                                "EVENTS"));
+   if (table->getNumRecords() != static_cast<tip::Index_t>(nevents)) {
+      throw std::runtime_error("The FT1 file has the wrong number of rows.");
+   }
+   size_t i(0);
+   for (tip::Table::ConstIterator row = table->begin();
+        row != table->end(); ++row, i++) {
+      double time;
+      (*row)["TIME"].get(time);
+      tip::BitStruct eventType;
+      (*row)["EVENT_TYPE"].get(eventType);
+      if (time != i || eventType != (1u << (i % 32))) {
+         throw std::runtime_error("The FT1 file differs from the "
+                                  "buffered events.");
+      }
+   }
+   std::unique_ptr<const tip::Table>
+      gti(tip::IFileSvc::instance().readTable("test_ft1_write_0000.fits",
+                                              "GTI"));
+   if (gti->getNumRecords() != 1) {
+      throw std::runtime_error("The FT1 file does not have a single GTI.");
+   }
+   std::cout << "Wrote " << nevents << " FT1 rows in " << writeTime
+             << " s (target: under 1 s per million rows)." << std::endl;
+}
+
+void test_ft2_write_rate() {
+// As for the FT1 file, for 100000 rows of spacecraft data.
+   const size_t nrows(100000);
+   observationSim::LatSc spacecraft;
+   observationSim::ScDataContainer scData("test_ft2_write", "SC_DATA",
+                                          nrows + 1);
+   for (size_t i = 0; i < nrows; i++) {
+      scData.addScData(30.*i, &spacecraft);
+   }
+   std::chrono::steady_clock::time_point start
+      (std::chrono::steady_clock::now());
+   scData.close();
+   double writeTime(seconds(start));
+
+   std::unique_ptr<const tip::Table>
+      table(tip::IFileSvc::instance().readTable("test_ft2_write_0000.fits",
+                                                "SC_DATA"));
+   if (table->getNumRecords() != static_cast<tip::Index_t>(nrows)) {
+      throw std::runtime_error("The FT2 file has the wrong number of rows.");
+   }
+   size_t i(0);
+   for (tip::Table::ConstIterator row = table->begin();
+        row != table->end(); ++row, i++) {
+      double time;
+      (*row)["START"].get(time);
+      if (time != 30.*i) {
+         throw std::runtime_error("The FT2 file differs from the "
+                                  "buffered rows.");
+      }
+   }
+   std::cout << "Wrote " << nrows << " FT2 rows in " << writeTime
+             << " s (target: under 1 s per million rows)." << std::endl;
+}
+
+void test_exposure_sampler(std::vector<irfInterface::Irfs *> & respPtrs,
+                           const std::vector<std::string> & fileList) {
+// A day of events from a steady point source is simulated photon by
+// photon and sampled from the exposure.  The numbers of events and
+// the fractions above 1 GeV must agree within the statistical
+// errors.
+   const double simTime(86400.);
+   std::vector<std::string> names(1, "PKS0528p134");
+   double counts[2];
+   double highFraction[2];
+   for (size_t sampled = 0; sampled < 2; sampled++) {
+      observationSim::Simulator simulator(names, fileList, 1.21);
+      if (sampled) {
+         simulator.setExposureSources(names);
+      }
+      observationSim::EventContainer events(sampled ? "test_sampled"
+                                            : "test_photons", "EVENTS",
+                                            0, 1000000);
+      observationSim::ScDataContainer scData("test_exposure_scData",
+                                             "SC_DATA", 20000, false);
+      observationSim::LatSc spacecraft;
+      simulator.generateEvents(simTime, events, scData, respPtrs,
+                               &spacecraft);
+      std::vector<double> energies;
+      events.getColumn("ENERGY", energies);
+      counts[sampled] = energies.size();
+      highFraction[sampled] = 0;
+      for (size_t i = 0; i < energies.size(); i++) {
+         if (energies[i] > 1e3) {
+            highFraction[sampled] += 1./energies.size();
+         }
+      }
+   }
+   if (counts[0] == 0 || counts[1] == 0) {
+      throw std::runtime_error("No events from the test source.");
+   }
+   double fraction((highFraction[0] + highFraction[1])/2.);
+   if (std::fabs(counts[0] - counts[1])
+       > 4.*std::sqrt(counts[0] + counts[1])
+       || std::fabs(highFraction[0] - highFraction[1])
+       > 4.*std::sqrt(fraction*(1. - fraction)
+                      *(1./counts[0] + 1./counts[1])) + 1e-3) {
+      throw std::runtime_error("The exposure sampler differs from the "
+                               "photon by photon simulation.");
+   }
+   std::cout << "Photon by photon: " << counts[0] << " events, "
+             << highFraction[0] << " above 1 GeV; exposure sampler: "
+             << counts[1] << " events, " << highFraction[1]
+             << " above 1 GeV." << std::endl;
+}
+
+namespace {
+/// Write a source library of faint point sources named catalog_src_<i>.
+   void writeCatalog(const std::string & filename, int nsources) {
+      std::ofstream output(filename.c_str());
+      output << "<source_library title=\"test catalog\">\n";
+      for (int i = 0; i < nsources; i++) {
+         output << "<source name=\"catalog_src_" << i
+                << "\" flux=\"1e-3\">\n"
+                << "<spectrum escale=\"MeV\">\n"
+                << "<particle name=\"gamma\"> <power_law emin=\"20.\" "
+                << "emax=\"2e5\" gamma=\"2.1\"/> </particle>\n"
+                << "<celestial_dir ra=\"" << 360.*i/nsources
+                << "\" dec=\"" << 180.*(i % 179)/179. - 89. << "\"/>\n"
+                << "</spectrum>\n</source>\n";
+      }
+      output << "</source_library>\n";
+      if (!output) {
+         throw std::runtime_error("Cannot write " + filename);
+      }
+   }
+}
+
+void test_source_model_cache(const std::vector<std::string> & fileList) {
+// The startup time of a simulation of one source from a catalog of
+// 5000 point sources, with FluxMgr parsing the whole catalog and
+// parsing the reduced model, when the latter is first created (cold)
+// and when it is found in the cache (warm).
+   const int nsources(5000);
+   std::string catalog("test_catalog.xml");
+   writeCatalog(catalog, nsources);
+
+// time_source.xml is kept as is, and the "default" source sets the
+// LAT cross-section, as in gtobssim.
+   std::vector<std::string> names(1, "catalog_src_1");
+   std::vector<std::string> libraries;
+   libraries.push_back(fileList.front());
+   libraries.push_back(catalog);
+   std::vector<std::string> fullList(1, fileList.back());
+   fullList.insert(fullList.end(), libraries.begin(), libraries.end());
+
+   std::chrono::steady_clock::time_point start(
+      std::chrono::steady_clock::now());
+   {
+      observationSim::Simulator simulator(names, fullList, 1.21);
+   }
+   double fullTime(seconds(start));
+
+   std::vector<std::string> cachedNames(names);
+   cachedNames.push_back("default");
+   observationSim::SourceModelCache cache(".");
+   double times[2];
+   std::string modelFile;
+   for (int warm = 0; warm < 2; warm++) {
+      if (!warm) {
+         std::remove(cache.modelFile(libraries, cachedNames).c_str());
+      }
+      start = std::chrono::steady_clock::now();
+      modelFile = cache.modelFile(libraries, cachedNames);
+      if (cache.hit() != bool(warm)) {
+         throw std::runtime_error("Unexpected source model cache "
+                                  "lookup result.");
+      }
+      std::vector<std::string> reducedList(1, fileList.back());
+      reducedList.push_back(modelFile);
+      observationSim::Simulator simulator(names, reducedList, 1.21);
+      times[warm] = seconds(start);
+   }
+
+   std::map<std::string, std::string> original;
+   std::map<std::string, std::string> reduced;
+   observationSim::SourceModelCache::sourceDefinitions(libraries, names,
+                                                       original);
+   observationSim::SourceModelCache::
+      sourceDefinitions(std::vector<std::string>(1, modelFile), names,
+                        reduced);
+   if (original.empty() || reduced != original) {
+      throw std::runtime_error("The cached source model does not match "
+                               "the catalog.");
+   }
+   std::cout << "Simulator startup for one of " << nsources
+             << " catalog sources: " << fullTime << " s from the catalog, "
+             << times[0] << " s creating the cached model, " << times[1]
+             << " s reusing it." << std::endl;
+}
+
+void test_lazy_sources() {
+// The startup time and the number of sources kept in memory for a
+// catalog of 5000 faint point sources, when the first photon is
+// drawn.  Only the sources with arrivals before the end of the
+// simulation are kept.  The arrivals must come in time order.
+   const int nsources(5000);
+   const double simTime(100.);
+   std::string catalog("test_catalog.xml");
+   writeCatalog(catalog, nsources);
+   FluxMgr fluxMgr(std::vector<std::string>(1, catalog));
+   observationSim::SourceScheduler scheduler;
+   for (int i = 0; i < nsources; i++) {
+      std::ostringstream name;
+      name << "catalog_src_" << i;
+      scheduler.addSource(name.str(), &fluxMgr);
+   }
+   scheduler.setHorizon(simTime);
+   std::chrono::steady_clock::time_point start(
+      std::chrono::steady_clock::now());
+   double time(0);
+   if (scheduler.event(time) == 0) {
+      throw std::runtime_error("No photons from the test catalog.");
+   }
+   double startup(seconds(start));
+   size_t resident(scheduler.residentSources());
+   long nphot(0);
+   do {
+      double arrival(time + scheduler.interval(time));
+      if (arrival < time) {
+         throw std::runtime_error("SourceScheduler arrivals are out of "
+                                  "order.");
+      }
+      time = arrival;
+      nphot++;
+   } while (time < simTime && scheduler.event(time));
+   if (resident >= static_cast<size_t>(nsources)) {
+      throw std::runtime_error("SourceScheduler keeps sources with no "
+                               "arrivals in the simulation.");
+   }
+   std::cout << "SourceScheduler: " << startup << " s to the first of "
+             << nphot << " photons in " << simTime << " s, with "
+             << resident << " of " << nsources << " sources in memory."
+             << std::endl;
+}
+
+void test_chunked_output() {
+// Events streamed to the files in chunks must give the same files as
+// the events written at once, both within a single file and when the
+// output rolls over to new files at the maximum number of rows.
+   const size_t nevents(25000);
+   const unsigned int maxRows(10000);
+   const char * roots[] = {"test_whole", "test_chunked"};
+   std::vector<double> times[2];
+   size_t nfiles[2];
+   for (size_t chunked = 0; chunked < 2; chunked++) {
+      observationSim::EventContainer events(roots[chunked], "EVENTS", 0,
+                                            maxRows);
+      if (chunked) {
+         events.setChunkRows(1000);
+      }
+      addTestEvents(events, nevents);
+      events.close();
+      times[chunked] = readTimes(roots[chunked], nfiles[chunked]);
+   }
+   if (times[0].size() != nevents || times[1] != times[0]
+       || nfiles[1] != nfiles[0] || nfiles[0] != 3) {
+      throw std::runtime_error("Chunked output differs from the output "
+                               "written at once.");
+   }
+   for (size_t i = 0; i < nevents; i++) {
+      if (times[1][i] != i) {
+         throw std::runtime_error("Chunked output has the wrong events.");
+      }
+   }
+   std::cout << "Chunked output matches the output written at once."
+             << std::endl;
+}
+
+void test_memory_budget() {
+// With a budget of 1000 rows, the buffered rows, including those
+// being written by an AsyncWriter, never exceed the budget by more
+// than a row, and all of the events are written, in order, to files
+// rolled over as the budget requires.
+   const size_t nevents(25000);
+   size_t rowBytes;
+   {
+      observationSim::EventContainer events("test_row_size", "EVENTS");
+      addTestEvents(events, 1);
+      rowBytes = events.bufferedBytes();
+   }
+   const char * roots[] = {"test_budget", "test_budget_async"};
+   for (size_t async = 0; async < 2; async++) {
+      observationSim::MemoryBudget budget(1000*rowBytes);
+      observationSim::AsyncWriter writer;
+      std::vector<double> times;
+      size_t nfiles;
+      {
+         observationSim::EventContainer events(roots[async], "EVENTS", 0,
+                                               1000000);
+         events.setMemoryBudget(&budget);
+         if (async) {
+            events.setWriter(&writer);
+         }
+         addTestEvents(events, nevents);
+         events.close();
+      }
+      times = readTimes(roots[async], nfiles);
+      if (budget.peakBytes() > budget.maxBytes() + rowBytes) {
+         throw std::runtime_error("The buffered rows exceed the memory "
+                                  "budget.");
+      }
+      if (times.size() != nevents || nfiles < nevents/1000) {
+         throw std::runtime_error("The memory budget did not roll over "
+                                  "the output files.");
+      }
+      for (size_t i = 0; i < nevents; i++) {
+         if (times[i] != i) {
+            throw std::runtime_error("Events are missing or out of order "
+                                     "with a memory budget.");
+         }
+      }
+      std::cout << "Memory budget of " << budget.maxBytes() << " bytes"
+                << (async ? " with an AsyncWriter" : "") << ": peak of "
+                << budget.peakBytes() << " bytes in " << nfiles
+                << " files." << std::endl;
+   }
+}
+
+void test_gzip_output() {
+// A gzipped FT1 file replaces the uncompressed one and reads back
+// with the same events.
+   const size_t nevents(25000);
+   const char * roots[] = {"test_plain", "test_gzip"};
+   std::vector<double> times[2];
+   size_t nfiles[2];
+   for (size_t compress = 0; compress < 2; compress++) {
+      std::remove((std::string(roots[compress])
+                   + "_0000.fits").c_str());
+      observationSim::EventContainer events(roots[compress], "EVENTS");
+      events.setCompression(compress != 0);
+      addTestEvents(events, nevents);
+      events.close();
+      times[compress] = readTimes(roots[compress], nfiles[compress],
+                                  compress ? ".gz" : "");
+   }
+   if (st_facilities::Util::fileExists("test_gzip_0000.fits")) {
+      throw std::runtime_error("The uncompressed FT1 file was not "
+                               "removed.");
+   }
+   if (nfiles[1] != 1 || times[0].size() != nevents
+       || times[1] != times[0]) {
+      throw std::runtime_error("The gzipped FT1 file differs from the "
+                               "uncompressed one.");
+   }
+   std::cout << "The gzipped FT1 file reads back with the same "
+             << nevents << " events." << std::endl;
+}
+
+void test_source_scheduler() {
+// Ten sources of equal flux are scheduled.  The photons must come in
+// time order, each with the time of its scheduled arrival, and from
+// each source in equal numbers within the statistical errors.  After
+// an interval is skipped by reset(...), no arrivals fall within it.
+   const int nsources(10);
+   std::string catalog("test_scheduler_catalog.xml");
+   writeCatalog(catalog, nsources);
+   FluxMgr fluxMgr(std::vector<std::string>(1, catalog));
+   observationSim::SourceScheduler scheduler;
+   for (int i = 0; i < nsources; i++) {
+      std::ostringstream name;
+      name << "catalog_src_" << i;
+      scheduler.addSource(name.str(), &fluxMgr);
+   }
+   const double simTime(1e5);
+   const double skipStart(simTime/2.);
+   const double skipStop(skipStart + 1000.);
+   std::vector<double> counts(nsources, 0);
+   double time(0);
+   bool skipped(false);
+   EventSource * photon;
+   while ((photon = scheduler.event(time)) != 0) {
+      double arrival(time + scheduler.interval(time));
+      if (arrival < time || std::fabs(photon->time() - arrival) > 1e-6) {
+         throw std::runtime_error("SourceScheduler returned a photon out "
+                                  "of order or with the wrong time.");
+      }
+      if (skipped && arrival < skipStop) {
+         throw std::runtime_error("SourceScheduler returned an arrival "
+                                  "within a skipped interval.");
+      }
+      time = arrival;
+      if (time >= simTime) {
+         break;
+      }
+      if (!skipped && time >= skipStart) {
+         time = skipStop;
+         scheduler.reset(time);
+         skipped = true;
+         continue;
+      }
+      int id(scheduler.numSource());
+      if (id < 0 || id >= nsources) {
+         throw std::runtime_error("SourceScheduler returned an unknown "
+                                  "source ID.");
+      }
+      counts[id]++;
+   }
+   double mean(std::accumulate(counts.begin(), counts.end(), 0.)/nsources);
+   for (int i = 0; i < nsources; i++) {
+      if (mean == 0 || std::fabs(counts[i] - mean) > 5.*std::sqrt(mean)) {
+         throw std::runtime_error("SourceScheduler photon counts differ "
+                                  "between sources of equal flux.");
+      }
+   }
+   std::cout << "SourceScheduler: " << mean << " photons per source in "
+             << simTime << " s, in time order." << std::endl;
+}
+
+void test_dead_intervals(std::vector<irfInterface::Irfs *> & respPtrs,
+                         const std::vector<std::string> & fileList) {
+// Over a day, the simulation skips the SAA passages: nextLiveTime(...)
+// returns the end of a passage, and no events are generated within
+// one.
+   if (::getenv("DISABLE_SAA")) {
+      return;
+   }
+   const double simTime(86400.);
+   observationSim::LatSc spacecraft;
+   long saaSteps(0);
+   for (double time = 0; time < simTime; time += 60.) {
+      if (!spacecraft.inSaa(time)) {
+         continue;
+      }
+      saaSteps++;
+      double liveTime(spacecraft.nextLiveTime(time));
+      if (liveTime <= time || spacecraft.inSaa(liveTime)
+          || !spacecraft.inSaa(liveTime - 0.01)) {
+         throw std::runtime_error("LatSc::nextLiveTime does not return "
+                                  "the end of the SAA passage.");
+      }
+   }
+   if (saaSteps == 0) {
+      throw std::runtime_error("No SAA passages in the test day.");
+   }
+   std::vector<std::string> names(1, "PKS0528p134");
+   observationSim::Simulator simulator(names, fileList, 1.21);
+   observationSim::EventContainer events("test_dead_intervals", "EVENTS",
+                                         0, 1000000);
+   observationSim::ScDataContainer scData("test_dead_intervals_scData",
+                                          "SC_DATA", 20000, false);
+   simulator.generateEvents(simTime, events, scData, respPtrs,
+                            &spacecraft);
+   std::vector<double> times;
+   events.getColumn("TIME", times);
+   if (times.empty()) {
+      throw std::runtime_error("No events from the test source.");
+   }
+   for (size_t i = 0; i < times.size(); i++) {
+      if (spacecraft.inSaa(times[i])) {
+         throw std::runtime_error("An event was generated in the SAA.");
+      }
+   }
+   std::cout << times.size() << " events in a day, none of them in the "
+             << "SAA; " << saaSteps << " minutes in the SAA skipped."
+             << std::endl;
+}
+
+void test_event_cache(std::vector<irfInterface::Irfs *> & respPtrs,
+                      const std::vector<std::string> & fileList) {
+// A source is simulated once and its events cached.  A second run
+// with the same key replays the cache and must give the same events.
+   const double simTime(86400.);
+   std::vector<std::string> names(1, "PKS0528p134");
+   std::map<std::string, std::string> keys;
+   keys[names.front()] =
+      observationSim::SourceModelCache::hashKey("test_event_cache");
+   std::string cacheFile("events_" + keys[names.front()] + ".dat");
+   std::remove(cacheFile.c_str());
+   std::vector<double> times[2];
+   std::vector<double> energies[2];
+   for (size_t replay = 0; replay < 2; replay++) {
+      observationSim::Simulator simulator(names, fileList, 1.21);
+      simulator.setEventCache(".", keys);
+      observationSim::EventContainer events(replay ? "test_replayed"
+                                            : "test_cached", "EVENTS",
+                                            0, 1000000);
+      observationSim::ScDataContainer scData("test_cache_scData",
+                                             "SC_DATA", 20000, false);
+      observationSim::LatSc spacecraft;
+      simulator.generateEvents(simTime, events, scData, respPtrs,
+                               &spacecraft);
+      events.getColumn("TIME", times[replay]);
+      events.getColumn("ENERGY", energies[replay]);
+      if (!st_facilities::Util::fileExists(cacheFile)) {
+         throw std::runtime_error("The event cache was not written.");
+      }
+   }
+   if (times[0].empty() || times[1] != times[0]
+       || energies[1] != energies[0]) {
+      throw std::runtime_error("The replayed events differ from the "
+                               "cached ones.");
+   }
+   std::cout << "Replayed " << times[1].size() << " cached events."
+             << std::endl;
+}
+
+void test_ft1_merge(std::vector<irfInterface::Irfs *> & respPtrs,
+                    const std::vector<std::string> & fileList) {
+// The events of a background FT1 file are merged, in time order and
+// with their MC_SRC_ID values, with those of a simulated source,
+// which is numbered after the background IDs as in gtobssim.
+   const size_t nbkg(1000);
+   const int bkgId(7);
+   const double simTime(nbkg);
+   {
+      observationSim::EventContainer background("test_background",
+                                                "EVENTS", 0, nbkg + 1);
+      astro::SkyDir appDir(83.6, 22.0);
+      for (size_t i = 0; i < nbkg; i++) {
+         observationSim::Event event(i + 0.5, 100., appDir, appDir,
+                                     appDir, appDir, appDir, 0, 1, 100.,
+                                     0, 0, bkgId);
+         event.setEventClass(0);
+         background.addCachedEvent(event, "background_source", bkgId);
+      }
+      background.close();
+   }
+   std::string bkgFile("test_background_0000.fits");
+   int maxId(observationSim::Ft1EventFeed::maxSourceId(bkgFile, "EVENTS"));
+   if (maxId != bkgId) {
+      throw std::runtime_error("Ft1EventFeed::maxSourceId returned the "
+                               "wrong ID.");
+   }
+   std::vector<std::string> names(1, "PKS0528p134");
+   observationSim::Simulator simulator(names, fileList, 1.21);
+   simulator.setIdOffset(maxId + 1);
+   observationSim::LatSc spacecraft;
+   simulator.addEventFeed(new observationSim::Ft1EventFeed(bkgFile,
+                                                           "EVENTS", 0,
+                                                           &spacecraft));
+   observationSim::EventContainer events("test_merged", "EVENTS", 0,
+                                         1000000);
+   observationSim::ScDataContainer scData("test_merged_scData", "SC_DATA",
+                                          20000, false);
+   simulator.generateEvents(simTime, events, scData, respPtrs,
+                            &spacecraft);
+   std::vector<double> times;
+   events.getColumn("TIME", times);
+   for (size_t i = 1; i < times.size(); i++) {
+      if (times[i] < times[i-1]) {
+         throw std::runtime_error("The merged events are not in time "
+                                  "order.");
+      }
+   }
+   unsigned long merged(0);
+   typedef std::map<std::string,
+      observationSim::EventContainer::SourceSummary> SummaryMap_t;
+   const SummaryMap_t & summaries(events.eventIds());
+   for (SummaryMap_t::const_iterator summary = summaries.begin();
+        summary != summaries.end(); ++summary) {
+      if (summary->second.id == bkgId) {
+         merged += summary->second.acceptedNum;
+      } else if (summary->second.id <= maxId) {
+         throw std::runtime_error("A simulated source has the ID of the "
+                                  "background events.");
+      }
+   }
+   if (merged != nbkg) {
+      throw std::runtime_error("The background events were not all "
+                               "merged with their MC_SRC_ID.");
+   }
+   std::cout << "Merged " << merged << " background events with "
+             << times.size() - merged << " simulated ones." << std::endl;
+}